@@ -5,6 +5,11 @@
 #include <cstring>
 #include <chrono>
 #include <vector>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <condition_variable>
+#include <random>
 // relying on 'using namespace std;' to remove all 'std::' prefixes
 using namespace std;
 #define RESET "\033[0m"
@@ -28,21 +33,46 @@ using namespace std;
     #include <netinet/in.h>
     #include <arpa/inet.h>
     #include <unistd.h>
+    #include <csignal>
     #define SOCKET int
     #define INVALID_SOCKET -1
     #define SOCKET_ERROR -1
     #define closesocket close
 #endif
-#define SERVER_IP "127.0.0.1" // Change to actual server IP for testing
+#include "protocol.h"
+#include "tracing.h"
+#define SERVER_IP "127.0.0.1" // Default hub, override with --server
 #define TCP_PORT 8080
 #define UDP_PORT 8081
+#define BENCH_WINDOW 32          // messages in flight in load-test mode
 #define CLIENT_UDP_PORT 8082 // Port for receiving broadcasts
 #define BUFFER_SIZE 4096
-#define HEARTBEAT_INTERVAL 10 // seconds
+#define HEARTBEAT_INTERVAL 10 // seconds, sent only while the TCP connection is idle
+#define ADDRESS_REFRESH_INTERVAL 120 // seconds between UDP address refreshes while busy
+#define RECONNECT_BASE_MS 500    // first reconnect backoff ceiling
+#define RECONNECT_MAX_MS 30000   // backoff ceiling cap
+#define OUTBOX_LIMIT 1000        // unacknowledged messages kept across disconnects
+#define PACE_PROBE_INTERVALS 16  // pace intervals between tries of one more message per batch
 mutex consoleMutex;
 mutex messageMutex;
 vector<string> receivedMessages;
-bool isRunning = true;
+atomic<bool> isRunning(true);
+// Earliest steady-clock time (ms) at which we may send again after ERROR:RATE_LIMITED
+atomic<long long> backoffUntilMs(0);
+// Largest RETRY_MS since we were first throttled (about one token interval, a
+// single hint may only cover the rest of one); while non-zero the outbox is
+// sent in batches of paceBatch messages, one batch per this many ms
+atomic<long long> ratePaceMs(0);
+// Hub to talk to (any hub of a federated mesh will do)
+string serverIp = SERVER_IP;
+int tcpPort = TCP_PORT;
+int udpPort = UDP_PORT;
+// Load-test mode: no menu, no per-message console output
+bool benchMode = false;
+// Sampled tracing of our messages (and of traced messages we receive)
+TraceBuffer traceBuffer;
+double traceRate = 0.0;
+string traceFile;
 void waitAndClear() {
     cout << YELLOW << "\nPress any key to clear screen..." << RESET;
     cin.get(); // wait for ANY key
@@ -52,8 +82,66 @@ void waitAndClear() {
     system("clear");
 #endif
 }
+// Outgoing file transfer state, updated by the listener thread
+struct OutgoingTransfer {
+    int credits = 0;
+    bool done = false;
+    bool failed = false;
+    string result;
+};
+// Incoming file transfer being written to disk
+struct IncomingTransfer {
+    ofstream file;
+    string path;
+    string dept;
+    size_t bytes = 0;
+};
+mutex transferMutex;
+condition_variable transferCv;
+map<string, OutgoingTransfer> outgoingTransfers;   // transfer id -> state
+map<string, IncomingTransfer> incomingTransfers;   // "from/id" -> open file (listener thread only)
+int nextTransferId = 1;
+// Current server connection; replaced by the connection manager after a drop
+mutex connMutex;
+condition_variable connCv;
+SOCKET serverSocket = INVALID_SOCKET;
+bool connected = false;
+unsigned long connectionGeneration = 0;
+mutex sendMutex;   // serializes writes on the TCP socket (taken before connMutex)
+// Messages waiting for their ACK, keyed (and so flushed) by message id
+struct OutboxEntry {
+    string line;
+    unsigned long sentGeneration = 0;   // connection it was last sent on, 0 = not sent
+    unsigned long long traceId = 0;     // sampled message (|TRACE: in its header)
+    long long queuedMicros = 0;
+    long long sentMicros = 0;
+    unsigned long long sentSeq = 0;     // send order, see paceCutSeq
+};
+mutex outboxMutex;
+condition_variable outboxCv;
+map<long long, OutboxEntry> outbox;
+// Pacing after a rate limit (outboxMutex), as in TCP congestion control: each
+// batch that gets through doubles the next one up to paceThreshold, above it one
+// message is added every PACE_PROBE_INTERVALS intervals; a rejection halves the
+// batch and sets the threshold there. A busy sender settles near what the server
+// accepts instead of staying at one message per interval, and pacing ends once
+// the batch reaches OUTBOX_LIMIT
+size_t paceBatch = 1;
+size_t paceThreshold = OUTBOX_LIMIT;
+long long pacedId = 0;   // message whose ACK grows the batch, 0 = pick the next one sent
+long long paceProbeMs = 0;
+unsigned long long sendSeq = 0;
+unsigned long long paceCutSeq = 0;   // rejections of messages sent up to here were already counted
+// Ids keep increasing across client restarts so the server can tell resends apart
+atomic<long long> nextMessageId(chrono::duration_cast<chrono::milliseconds>(
+    chrono::system_clock::now().time_since_epoch()).count() * 1000);
 int clientUdpPort = 0;
 SOCKET clientUdpSocket = INVALID_SOCKET;
+// Last TCP send (steady ms); the server counts what it reads from us as liveness,
+// traffic it sends us proves nothing to it
+atomic<long long> lastTcpActivityMs(0);
+// Set on every (re)connect so the new connection learns our UDP address right away
+atomic<bool> udpRefreshNeeded(true);
 string currentCampus;
 // Thread-safe console output
 void printLog(const string& message) {
@@ -69,35 +157,153 @@ string getCurrentTime() {
     timeStr.pop_back();
     return timeStr;
 }
+// Milliseconds on the monotonic clock
+long long steadyNowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
 // Store received message
 void storeMessage(const string& message) {
     lock_guard<mutex> lock(messageMutex);
     receivedMessages.push_back(message);
 }
-// Send UDP heartbeat periodically using the shared bound UDP socket (clientUdpSocket)
+// Send raw bytes on the current connection as one uninterrupted write
+bool sendFrame(const string& frame) {
+    lock_guard<mutex> sendLock(sendMutex);
+    SOCKET sock;
+    {
+        lock_guard<mutex> lock(connMutex);
+        if (!connected) return false;
+        sock = serverSocket;
+    }
+    if (!sendAll(sock, frame)) return false;
+    lastTcpActivityMs.store(steadyNowMs(), memory_order_relaxed);
+    return true;
+}
+// Send one protocol line
+bool sendLine(const string& line) {
+    return sendFrame(line + "\n");
+}
+// Update an outgoing transfer from an ACK/ERROR carrying |XFER:<id>
+void finishTransfer(const string& id, bool failed, const string& result) {
+    lock_guard<mutex> lock(transferMutex);
+    auto it = outgoingTransfers.find(id);
+    if (it == outgoingTransfers.end()) return;
+    it->second.done = true;
+    it->second.failed = failed;
+    it->second.result = result;
+    transferCv.notify_all();
+}
+// Keep only characters that are safe in a local file name
+string safeFileName(const string& name) {
+    string safe;
+    for (char c : name) {
+        safe += (isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '-' || c == '_') ? c : '_';
+    }
+    if (safe.empty() || safe[0] == '.') safe = "file" + safe;
+    return safe;
+}
+// Handle XFER_* frames; chunks are written straight to disk. False on a broken stream.
+bool handleTransferFrame(FrameReader& reader, const string& line) {
+    string command = line.substr(0, line.find(':'));
+    string id = protocolField(line, command);
+    if (command == "XFER_CREDIT") {
+        lock_guard<mutex> lock(transferMutex);
+        auto it = outgoingTransfers.find(id);
+        if (it != outgoingTransfers.end()) {
+            it->second.credits += atoi(protocolField(line, "N").c_str());
+            transferCv.notify_all();
+        }
+        return true;
+    }
+    string from = protocolField(line, "FROM");
+    string key = from + "/" + id;
+    if (command == "XFER_OPEN") {
+        IncomingTransfer& transfer = incomingTransfers[key];
+        transfer.path = "received_" + safeFileName(from) + "_" + safeFileName(protocolField(line, "NAME"));
+        transfer.dept = protocolField(line, "DEPT");
+        transfer.file.open(transfer.path, ios::binary | ios::trunc);
+        printLog("Receiving file from " + from + " -> " + transfer.path +
+                 " (" + protocolField(line, "SIZE") + " bytes)");
+        return true;
+    }
+    if (command == "XFER_CHUNK") {
+        size_t length = strtoul(protocolField(line, "LEN").c_str(), nullptr, 10);
+        if (length > TRANSFER_CHUNK_SIZE) return false;
+        string data;
+        if (!reader.readBlock(length, data)) return false;
+        auto it = incomingTransfers.find(key);
+        if (it != incomingTransfers.end()) {
+            it->second.file.write(data.data(), static_cast<streamsize>(data.length()));
+            it->second.bytes += data.length();
+        }
+        return true;
+    }
+    auto it = incomingTransfers.find(key);
+    if (it == incomingTransfers.end()) return true;
+    it->second.file.close();
+    if (command == "XFER_END") {
+        storeMessage("From: " + from + "\n"
+                     "To: " + it->second.dept + "\n"
+                     "File: " + it->second.path + " (" + to_string(it->second.bytes) + " bytes)");
+        lock_guard<mutex> lock(consoleMutex);
+        cout << "\n" << GREEN << BOLD << "*** New file received! ***" << RESET << "\n" << endl;
+    } else {
+        remove(it->second.path.c_str());
+        printLog("File transfer from " + from + " was aborted");
+    }
+    incomingTransfers.erase(it);
+    return true;
+}
+// Send UDP heartbeats using the shared bound UDP socket (clientUdpSocket).
+// What we send over TCP already tells the server we are alive, so a heartbeat only
+// goes out after HEARTBEAT_INTERVAL seconds without sending; while busy we just refresh
+// our UDP address (for broadcasts) every ADDRESS_REFRESH_INTERVAL seconds
 void sendHeartbeat(const string& campusName) {
     if (clientUdpSocket == INVALID_SOCKET) return;
 
     sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = inet_addr(SERVER_IP);
-    serverAddr.sin_port = htons(UDP_PORT);
+    serverAddr.sin_addr.s_addr = inet_addr(serverIp.c_str());
+    serverAddr.sin_port = htons(udpPort);
 
+    long long lastUdpMs = 0;   // last heartbeat or address refresh
     while (isRunning) {
-        string heartbeat = "HEARTBEAT:" + campusName + ":" + to_string(clientUdpPort);
+        long long now = steadyNowMs();
+        long long idleMs = now - lastTcpActivityMs.load(memory_order_relaxed);
+        bool refresh = udpRefreshNeeded.exchange(false);   // a heartbeat carries the address too
+        string kind;
+        if (idleMs >= HEARTBEAT_INTERVAL * 1000LL && now - lastUdpMs >= HEARTBEAT_INTERVAL * 1000LL) {
+            kind = "HEARTBEAT:";
+        } else if (refresh || now - lastUdpMs >= ADDRESS_REFRESH_INTERVAL * 1000LL) {
+            kind = "UDP_ADDR:";
+        }
+        if (!kind.empty()) {
+            string heartbeat = kind + campusName + ":" + to_string(clientUdpPort);
 
-        sendto(clientUdpSocket,
-               heartbeat.c_str(),
-               (int)heartbeat.length(),
-               0,
-               (sockaddr*)&serverAddr,
-               sizeof(serverAddr));
+            sendto(clientUdpSocket,
+                   heartbeat.c_str(),
+                   (int)heartbeat.length(),
+                   0,
+                   (sockaddr*)&serverAddr,
+                   sizeof(serverAddr));
+            lastUdpMs = now;
+        }
 
-        this_thread::sleep_for(chrono::seconds(HEARTBEAT_INTERVAL));
+        this_thread::sleep_for(chrono::seconds(1));
     }
 }
 
 
+// Show an announcement from the server (UDP, or TCP before our first heartbeat)
+void showAnnouncement(const string& announcement) {
+    lock_guard<mutex> lock(consoleMutex);
+    cout << "\n" << MAGENTA << BOLD << "***************************" << RESET << endl;
+    cout << MAGENTA << BOLD << "*** SYSTEM ANNOUNCEMENT ***" << RESET << endl;
+    cout << YELLOW << announcement << RESET << endl;
+    cout << MAGENTA << BOLD << "***************************" << RESET << "\n" << endl;
+}
+
 // Listen for UDP broadcasts from server using shared clientUdpSocket
 void listenForBroadcasts() {
     if (clientUdpSocket == INVALID_SOCKET) {
@@ -120,98 +326,466 @@ void listenForBroadcasts() {
             string message(buffer, bytesReceived);
 
             if (message.find("BROADCAST:") == 0) {
-                string announcement = message.substr(10);
-                lock_guard<mutex> lock(consoleMutex);
-                cout << "\n" << MAGENTA << BOLD << "***************************" << RESET << endl;
-                cout << MAGENTA << BOLD << "*** SYSTEM ANNOUNCEMENT ***" << RESET << endl;
-                cout << YELLOW << announcement << RESET << endl;
-                cout << MAGENTA << BOLD << "***************************" << RESET << "\n" << endl;
+                showAnnouncement(message.substr(10));
             }
         }
     }
 }
 
-// Listen for incoming TCP messages from server
-void listenForMessages(SOCKET tcpSocket) {
-    char buffer[BUFFER_SIZE];
+// Drop the connection of the given generation and wake the connection manager
+void handleDisconnect(unsigned long generation) {
+    // Partial incoming files cannot be resumed on a new connection
+    for (auto& pair : incomingTransfers) {
+        pair.second.file.close();
+        remove(pair.second.path.c_str());
+    }
+    incomingTransfers.clear();
+    {
+        lock_guard<mutex> lock(transferMutex);
+        for (auto& pair : outgoingTransfers) {
+            pair.second.done = true;
+            pair.second.failed = true;
+            pair.second.result = "Connection to server lost";
+        }
+        transferCv.notify_all();
+    }
+    {
+        lock_guard<mutex> sendLock(sendMutex);
+        lock_guard<mutex> lock(connMutex);
+        if (connected && generation == connectionGeneration) {
+            connected = false;
+            closesocket(serverSocket);
+            serverSocket = INVALID_SOCKET;
+        }
+    }
+    connCv.notify_all();
+}
 
-    while (isRunning) {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytesReceived = recv(tcpSocket, buffer, BUFFER_SIZE - 1, 0);
+// Remove an acknowledged (or definitively failed) message from the outbox
+void retireMessage(const string& id) {
+    if (id.empty()) return;
+    {
+        lock_guard<mutex> lock(outboxMutex);
+        auto it = outbox.find(atoll(id.c_str()));
+        if (it == outbox.end()) return;
+        if (it->second.traceId && it->second.sentMicros) {
+            traceBuffer.record(it->second.traceId, "ack_wait", "client", it->second.sentMicros, traceNowMicros());
+        }
+        if (it->first == pacedId) {
+            pacedId = 0;
+            if (paceBatch < paceThreshold) {
+                paceBatch *= 2;
+            } else if (steadyNowMs() - paceProbeMs >= ratePaceMs * PACE_PROBE_INTERVALS) {
+                paceBatch++;
+                paceProbeMs = steadyNowMs();
+            }
+        }
+        outbox.erase(it);
+        if (outbox.empty() || paceBatch >= OUTBOX_LIMIT) {
+            ratePaceMs = 0;
+            paceBatch = 1;
+            paceThreshold = OUTBOX_LIMIT;
+        }
+    }
+    outboxCv.notify_all();
+}
 
-        if (bytesReceived <= 0) {
-            printLog("Disconnected from server");
-            isRunning = false;
+// Listen for incoming TCP messages from server (one message per line)
+void listenForMessages(shared_ptr<FrameReader> reader, unsigned long generation) {
+    string message;
+
+    while (isRunning) {
+        bool received = reader->readLine(message);
+        long long receivedMicros = traceNowMicros();
+        if (!received) {
+            if (isRunning) {
+                printLog("Disconnected from server");
+                handleDisconnect(generation);
+            }
             break;
         }
 
-        string message(buffer, bytesReceived);
-
+        // File transfer frames
+        if (message.rfind("XFER_", 0) == 0) {
+            if (!handleTransferFrame(*reader, message)) {
+                printLog("Broken file transfer stream from server");
+                handleDisconnect(generation);
+                break;
+            }
+        }
         // ACK message from server
-        if (message.rfind("ACK:", 0) == 0) {
-            printLog(message.substr(4));
+        else if (message.rfind("ACK:", 0) == 0) {
+            string xferId = protocolField(message, "XFER");
+            if (!xferId.empty()) {
+                finishTransfer(xferId, false, message.substr(4, message.find('|') - 4));
+            } else {
+                retireMessage(protocolField(message, "ID"));
+                if (!benchMode) printLog(message.substr(4, message.find('|') - 4));
+            }
+        }
+        // Server throttled us: ERROR:RATE_LIMITED|TARGET:x|RETRY_MS:n
+        else if (message.rfind("ERROR:RATE_LIMITED", 0) == 0) {
+            long long retryMs = 1000;
+            size_t retryPos = message.find("|RETRY_MS:");
+            if (retryPos != string::npos) {
+                try {
+                    retryMs = stoll(message.substr(retryPos + 10));
+                } catch (const exception&) {}
+            }
+            long long until = steadyNowMs() + retryMs;
+            if (until > backoffUntilMs) {
+                backoffUntilMs = until;
+            }
+            bool wasPacing = ratePaceMs > 0;
+            if (retryMs > ratePaceMs) {
+                ratePaceMs = retryMs;   // only this thread and retireMessage (also on it) write it
+            }
+            printLog("Rate limited by server - backing off " + to_string(retryMs) + " ms");
+            // The throttled message stays in the outbox and is resent after the back-off
+            string messageId = protocolField(message, "ID");
+            {
+                lock_guard<mutex> lock(outboxMutex);
+                pacedId = 0;
+                auto it = messageId.empty() ? outbox.end() : outbox.find(atoll(messageId.c_str()));
+                if (it != outbox.end()) {
+                    it->second.sentGeneration = 0;
+                    // One halving per burst: the rest of what was already sent is rejected too
+                    if (it->second.sentSeq > paceCutSeq) {
+                        size_t inFlight = 0;
+                        for (const auto& pair : outbox) {
+                            if (pair.second.sentGeneration != 0) inFlight++;
+                        }
+                        // Unpaced we had inFlight out: start from one and double up to half of it
+                        paceBatch = wasPacing ? max<size_t>(1, paceBatch / 2) : 1;
+                        paceThreshold = wasPacing ? paceBatch : max<size_t>(1, inFlight / 2);
+                        paceProbeMs = steadyNowMs();
+                        paceCutSeq = sendSeq;
+                    }
+                }
+            }
+            outboxCv.notify_all();
+            string xferId = protocolField(message, "XFER");
+            if (!xferId.empty()) {
+                finishTransfer(xferId, true, "Rate limited, try again in " + to_string(retryMs) + " ms");
+            }
         }
         // ERROR message from server
         else if (message.rfind("ERROR:", 0) == 0) {
-            printLog("ERROR - " + message.substr(6));
+            string xferId = protocolField(message, "XFER");
+            if (!xferId.empty()) {
+                finishTransfer(xferId, true, message.substr(6, message.find('|') - 6));
+            } else {
+                retireMessage(protocolField(message, "ID"));
+                printLog("ERROR - " + message.substr(6, message.find('|') - 6));
+            }
+        }
+        // Broadcast delivered over TCP
+        else if (message.rfind("BROADCAST:", 0) == 0) {
+            showAnnouncement(message.substr(10));
         }
-        // Incoming message from another campus
+        // Incoming message from another campus (one pass over the header)
         else if (message.rfind("TARGET:", 0) == 0) {
+            RouteHeader header;
+            if (parseRouteHeader(message, header)) {
+                unsigned long long traceId = parseTraceId(string(header.trace));
+                // Load-test receiver: nothing to store or show, only traced receipts
+                if (benchMode) {
+                    if (traceId) {
+                        traceBuffer.record(traceId, "receive", "client", receivedMicros, traceNowMicros());
+                    }
+                    continue;
+                }
+                bool urgent = header.priority == "URGENT";
 
-            // Extract message parts
-            size_t deptPos = message.find("|DEPT:");
-            size_t fromPos = message.find("|FROM:");
-            size_t msgPos = message.find("|MSG:");
-
-            if (deptPos != string::npos &&
-                fromPos != string::npos &&
-                msgPos != string::npos) {
-
-                string targetDept = message.substr(deptPos + 6, fromPos - deptPos - 6);
-                string sourceCampus = message.substr(fromPos + 6, msgPos - fromPos - 6);
-                string msg = message.substr(msgPos + 5);
-        size_t ackPos = msg.find("ACK:");
-        if (ackPos != string::npos) {
-            msg = msg.substr(0, ackPos);
-        }
                 // Store a simplified version (just the data)
                 string storedMsg =
-                    "From: " + sourceCampus + "\n"
-                    "To: " + targetDept + "\n"
-                    "Message: " + msg;
+                    string(urgent ? "Priority: URGENT\n" : "") +
+                    "From: " + string(header.from) + "\n"
+                    "To: " + string(header.dept) + "\n"
+                    "Message: " + string(header.msg);
 
                 storeMessage(storedMsg);
+                if (traceId) {
+                    traceBuffer.record(traceId, "receive", "client", receivedMicros, traceNowMicros());
+                }
 
                 // Just notify user
                 lock_guard<mutex> lock(consoleMutex);
-                cout << "\n" << GREEN << BOLD
-                              << "*** New message received! ***"
+                cout << "\n" << (urgent ? RED : GREEN) << BOLD
+                              << (urgent ? "*** New URGENT message received! ***" : "*** New message received! ***")
                               << RESET << "\n" << endl;
             }
         }
         // Anything else
-        else {
+        else if (!benchMode) {
             printLog("Unknown message received");
         }
     }
 }
 
+// Open a connection and log in; the reader keeps any bytes that arrived after AUTH_SUCCESS
+enum ConnectResult { CONNECT_OK, CONNECT_FAILED, AUTH_REJECTED, CAMPUS_BUSY };
+ConnectResult connectToServer(const string& campusName, const string& password,
+                              SOCKET& sock, shared_ptr<FrameReader>& reader) {
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) return CONNECT_FAILED;
+
+    sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr(serverIp.c_str());
+    serverAddr.sin_port = htons(tcpPort);
+    if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return CONNECT_FAILED;
+    }
+
+    string authMsg = "Campus:" + campusName + ",Pass:" + password + ",Proto:" + to_string(PROTOCOL_VERSION);
+    reader = make_shared<FrameReader>(sock);
+    string response;
+    if (!sendAll(sock, authMsg + "\n") || !reader->readLine(response)) {
+        closesocket(sock);
+        return CONNECT_FAILED;
+    }
+    if (response == "AUTH_SUCCESS") return CONNECT_OK;
+    closesocket(sock);
+    if (response == "AUTH_FAILED") return AUTH_REJECTED;
+    if (response == "ALREADY_CONNECTED") return CAMPUS_BUSY;
+    return CONNECT_FAILED;
+}
+
+// Make a freshly authenticated socket the current connection
+void installConnection(SOCKET sock, shared_ptr<FrameReader> reader) {
+    unsigned long generation;
+    {
+        lock_guard<mutex> lock(connMutex);
+        serverSocket = sock;
+        connected = true;
+        generation = ++connectionGeneration;
+    }
+    udpRefreshNeeded = true;
+    thread messageThread(listenForMessages, reader, generation);
+    messageThread.detach();
+    outboxCv.notify_all();
+}
+
+// Reconnect with full-jitter exponential backoff: each attempt waits a random
+// time up to min(RECONNECT_MAX_MS, RECONNECT_BASE_MS * 2^attempt), so a fleet
+// of clients that lost the same server spreads its reconnects out
+void connectionManager(string campusName, string password) {
+    mt19937 random(random_device{}());
+    int attempt = 0;
+    while (isRunning) {
+        {
+            unique_lock<mutex> lock(connMutex);
+            connCv.wait(lock, [] { return !connected || !isRunning; });
+        }
+        if (!isRunning) break;
+
+        long long ceiling = min<long long>(RECONNECT_MAX_MS, (long long)RECONNECT_BASE_MS << min(attempt, 16));
+        long long delay = uniform_int_distribution<long long>(0, ceiling)(random);
+        attempt++;
+        printLog("Reconnecting in " + to_string(delay) + " ms (attempt " + to_string(attempt) + ")");
+        this_thread::sleep_for(chrono::milliseconds(delay));
+        if (!isRunning) break;
+
+        SOCKET sock;
+        shared_ptr<FrameReader> reader;
+        ConnectResult result = connectToServer(campusName, password, sock, reader);
+        if (result == CONNECT_OK) {
+            installConnection(sock, reader);
+            size_t pending;
+            {
+                lock_guard<mutex> lock(outboxMutex);
+                pending = outbox.size();
+            }
+            printLog("Reconnected to server, resending " + to_string(pending) + " pending message(s)");
+            attempt = 0;
+        } else if (result == AUTH_REJECTED) {
+            printLog("Server rejected our credentials - giving up, please restart the client");
+            isRunning = false;
+        }
+        // CONNECT_FAILED / CAMPUS_BUSY (server has not noticed the old drop yet): retry
+    }
+}
+
+// Flush the outbox in id order: every entry not yet sent on the current
+// connection is written back to back without waiting for ACKs. After the
+// server throttled us only one entry goes out per RETRY_MS, so a backlog is
+// not resent all at once into an empty token bucket
+void outboxSender() {
+    while (isRunning) {
+        vector<string> lines;
+        vector<unsigned long long> traceIds;   // parallel to lines, 0 when not sampled
+        long long collectedMicros = traceNowMicros();
+        {
+            unique_lock<mutex> lock(outboxMutex);
+            unsigned long generation = 0;
+            auto hasUnsent = [&] {
+                {
+                    lock_guard<mutex> connLock(connMutex);
+                    if (!connected) return false;
+                    generation = connectionGeneration;
+                }
+                for (const auto& pair : outbox) {
+                    if (pair.second.sentGeneration != generation) return true;
+                }
+                return false;
+            };
+            if (!outboxCv.wait_for(lock, chrono::milliseconds(200), hasUnsent)) continue;
+            long long waitMs = backoffUntilMs - steadyNowMs();
+            if (waitMs > 0) {
+                outboxCv.wait_for(lock, chrono::milliseconds(waitMs));
+                continue;
+            }
+            long long paceMs = ratePaceMs;
+            for (auto& pair : outbox) {
+                if (paceMs > 0 && lines.size() >= paceBatch) break;
+                if (pair.second.sentGeneration != generation) {
+                    pair.second.sentGeneration = generation;
+                    pair.second.sentSeq = ++sendSeq;
+                    if (paceMs > 0 && pacedId == 0) pacedId = pair.first;
+                    lines.push_back(pair.second.line);
+                    traceIds.push_back(pair.second.traceId);
+                    if (pair.second.traceId) {
+                        collectedMicros = traceNowMicros();
+                        pair.second.sentMicros = collectedMicros;
+                        traceBuffer.record(pair.second.traceId, "outbox_wait", "client",
+                                           pair.second.queuedMicros, collectedMicros);
+                    }
+                }
+            }
+            if (paceMs > 0 && !lines.empty()) {
+                long long until = steadyNowMs() + paceMs;
+                long long seen = backoffUntilMs;
+                while (until > seen && !backoffUntilMs.compare_exchange_weak(seen, until)) {}
+            }
+        }
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (!sendLine(lines[i])) break;   // the listener notices the drop and we resend later
+            if (traceIds[i]) {
+                traceBuffer.record(traceIds[i], "client_send", "client", collectedMicros, traceNowMicros());
+            }
+        }
+    }
+}
+
+// Queue a message for delivery; it stays in the outbox until the server answers
+bool queueMessage(long long id, const string& line, unsigned long long traceId = 0) {
+    {
+        lock_guard<mutex> lock(outboxMutex);
+        if (outbox.size() >= OUTBOX_LIMIT) return false;
+        OutboxEntry& entry = outbox[id];
+        entry.line = line;
+        entry.traceId = traceId;
+        entry.queuedMicros = traceId ? traceNowMicros() : 0;
+    }
+    outboxCv.notify_all();
+    return true;
+}
+
+// Stream a file to another campus in TRANSFER_CHUNK_SIZE chunks, sending only
+// while we hold credits so the server never has to buffer more than a window
+void sendFile(const string& campusName, const string& targetCampus,
+              const string& targetDept, const string& path) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file) {
+        cout << RED << BOLD << "ERROR - Unable to open " << path << RESET << endl;
+        return;
+    }
+    long long size = file.tellg();
+    file.seekg(0);
+    string name = path.substr(path.find_last_of("/\\") == string::npos ? 0 : path.find_last_of("/\\") + 1);
+
+    string id;
+    {
+        lock_guard<mutex> lock(transferMutex);
+        id = to_string(nextTransferId++);
+        outgoingTransfers[id] = OutgoingTransfer();
+    }
+    sendLine("XFER_OPEN:" + id + "|TARGET:" + targetCampus + "|DEPT:" + targetDept +
+                        "|FROM:" + campusName + "|NAME:" + safeFileName(name) + "|SIZE:" + to_string(size));
+
+    vector<char> chunk(TRANSFER_CHUNK_SIZE);
+    long long sent = 0;
+    int lastPercent = -1;
+    bool ok = true;
+    for (long long seq = 0; ok && sent < size; seq++) {
+        {
+            unique_lock<mutex> lock(transferMutex);
+            OutgoingTransfer& transfer = outgoingTransfers[id];
+            if (!transferCv.wait_for(lock, chrono::seconds(30),
+                                     [&] { return transfer.credits > 0 || transfer.done || !isRunning; }) ||
+                transfer.done || !isRunning) {
+                ok = false;
+                break;
+            }
+            transfer.credits--;
+        }
+        file.read(chunk.data(), TRANSFER_CHUNK_SIZE);
+        streamsize length = file.gcount();
+        if (length <= 0) break;
+        string header = "XFER_CHUNK:" + id + "|SEQ:" + to_string(seq) + "|LEN:" + to_string(length);
+        ok = sendFrame(header + "\n" + string(chunk.data(), static_cast<size_t>(length)));
+        sent += length;
+        int percent = size > 0 ? static_cast<int>(sent * 100 / size) : 100;
+        if (percent / 10 != lastPercent / 10) {
+            lastPercent = percent;
+            cout << CYAN << "  ... " << percent << "% (" << sent << "/" << size << " bytes)" << RESET << endl;
+        }
+    }
+
+    unique_lock<mutex> lock(transferMutex);
+    OutgoingTransfer& transfer = outgoingTransfers[id];
+    if (ok) {
+        lock.unlock();
+        sendLine("XFER_END:" + id);
+        lock.lock();
+        transferCv.wait_for(lock, chrono::seconds(30), [&] { return transfer.done || !isRunning; });
+    } else if (!transfer.done) {
+        lock.unlock();
+        sendLine("XFER_ABORT:" + id);
+        lock.lock();
+        transfer.failed = true;
+        transfer.result = "Transfer timed out";
+    }
+    if (transfer.done && !transfer.failed) {
+        cout << GREEN << BOLD << transfer.result << RESET << endl;
+    } else {
+        cout << RED << BOLD << "ERROR - " << (transfer.result.empty() ? "Transfer not confirmed" : transfer.result)
+             << RESET << endl;
+    }
+    outgoingTransfers.erase(id);
+}
+
 // Display menu and handle user input
-void displayMenu(SOCKET tcpSocket, const string& campusName) {
+void displayMenu(const string& campusName) {
     string input;
     
     while (isRunning) {
+            bool online;
+            size_t pending;
+            {
+                lock_guard<mutex> lock(connMutex);
+                online = connected;
+            }
+            {
+                lock_guard<mutex> lock(outboxMutex);
+                pending = outbox.size();
+            }
             cout << "\n" << CYAN << BOLD << "=============================" << RESET << endl;
             cout << CYAN << BOLD << "=== " << campusName << " Campus Client ===" << RESET << endl;
             cout << CYAN << BOLD << "=============================" << RESET << endl;
+            cout << (online ? GREEN : RED) << (online ? "Status: ONLINE" : "Status: RECONNECTING")
+                 << RESET << YELLOW << "   Pending messages: " << pending << RESET << endl;
     cout << GREEN << "1. Send Message to Another Campus" << RESET << endl;
     cout << GREEN << "2. View Received Messages" << RESET << endl;
-    cout << GREEN << "3. Exit" << RESET << endl;
+    cout << GREEN << "3. Send File to Another Campus" << RESET << endl;
+    cout << GREEN << "4. Exit" << RESET << endl;
             cout << "\n" << WHITE << BOLD << "Choice: " << RESET;
 
             getline(cin, input);
             if (input == "1") {
-                string targetCampus, targetDept, message;
+                string targetCampus, targetDept, priority, message;
                 
                 cout << "\n" << YELLOW << "Available Campuses: Islamabad, Lahore, Karachi, Peshawar, CFD, Multan" << RESET << endl;
                 cout << WHITE << BOLD << "Enter target campus: " << RESET;
@@ -220,21 +794,29 @@ void displayMenu(SOCKET tcpSocket, const string& campusName) {
                 cout << YELLOW << "Available Departments: Admissions, Academics, IT, Sports" << RESET << endl;
                 cout << WHITE << BOLD << "Enter target department: " << RESET;
                 getline(cin, targetDept);
+                cout << WHITE << BOLD << "Priority (1 = Urgent, 2 = Normal) [2]: " << RESET;
+                getline(cin, priority);
                 cout << WHITE << BOLD << "Enter your message: " << RESET;
             
                 getline(cin, message);            
-                // Format: TARGET:CampusName|DEPT:DeptName|FROM:SourceCampus|MSG:Message
+                // Format: TARGET:CampusName|DEPT:DeptName|FROM:SourceCampus[|PRI:URGENT]|ID:n[|TRACE:id]|MSG:Message
+                long long id = nextMessageId++;
+                unsigned long long traceId = traceSample(traceRate) ? newTraceId() : 0;
                 string formattedMsg = "TARGET:" + targetCampus +
                                       "|DEPT:" + targetDept +
                                       "|FROM:" + campusName +
+                                      (priority == "1" ? "|PRI:URGENT" : "") +
+                                      "|ID:" + to_string(id) +
+                                      (traceId ? "|TRACE:" + traceIdString(traceId) : "") +
                                       "|MSG:" + message;
                 
-                int result = send(tcpSocket, formattedMsg.c_str(), formattedMsg.length(), 0);
-                
-                if (result == SOCKET_ERROR) {
-                cout << RED << BOLD << "ERROR - Unable to deliver message" << RESET << endl;
+                // The outbox sender delivers it (after any rate-limit back-off) and
+                // keeps it until the server acknowledges, across reconnects
+                if (!queueMessage(id, formattedMsg, traceId)) {
+                cout << RED << BOLD << "ERROR - Outbox full, message not queued" << RESET << endl;
                 } else {
-                cout << GREEN << BOLD << "Message sent successfully!" << RESET << endl;
+                cout << GREEN << BOLD << (online ? "Message queued for delivery!" :
+                                          "Offline - message will be sent after reconnecting") << RESET << endl;
                 waitAndClear();
                 }
                 
@@ -257,6 +839,23 @@ void displayMenu(SOCKET tcpSocket, const string& campusName) {
                 }
                 
             } else if (input == "3") {
+                string targetCampus, targetDept, path;
+                cout << "\n" << YELLOW << "Available Campuses: Islamabad, Lahore, Karachi, Peshawar, CFD, Multan" << RESET << endl;
+                cout << WHITE << BOLD << "Enter target campus: " << RESET;
+                getline(cin, targetCampus);
+                cout << YELLOW << "Available Departments: Admissions, Academics, IT, Sports" << RESET << endl;
+                cout << WHITE << BOLD << "Enter target department: " << RESET;
+                getline(cin, targetDept);
+                cout << WHITE << BOLD << "Enter file path: " << RESET;
+                getline(cin, path);
+                if (online) {
+                    sendFile(campusName, targetCampus, targetDept, path);
+                } else {
+                    cout << RED << BOLD << "ERROR - Not connected to server, try again later" << RESET << endl;
+                }
+                waitAndClear();
+
+            } else if (input == "4") {
                 cout << YELLOW << "Disconnecting from server..." << RESET << endl;
                 isRunning = false;
                 break;
@@ -266,21 +865,78 @@ void displayMenu(SOCKET tcpSocket, const string& campusName) {
             }
     }
 }
-int main() {
+// Load test: pipeline count messages to target with a fixed window and report
+// the delivered (ACKed) rate; count 0 just stays connected as a receiver
+void runLoadTest(const string& campusName, const string& targetCampus, long long count, size_t window) {
+    auto start = chrono::steady_clock::now();
+    for (long long i = 0; i < count; i++) {
+        {
+            unique_lock<mutex> lock(outboxMutex);
+            outboxCv.wait(lock, [&] { return outbox.size() < window; });
+        }
+        long long id = nextMessageId++;
+        unsigned long long traceId = traceSample(traceRate) ? newTraceId() : 0;
+        queueMessage(id, "TARGET:" + targetCampus + "|DEPT:IT|FROM:" + campusName + "|ID:" + to_string(id) +
+                         (traceId ? "|TRACE:" + traceIdString(traceId) : "") + "|MSG:load test " + to_string(i),
+                     traceId);
+    }
+    {
+        unique_lock<mutex> lock(outboxMutex);
+        outboxCv.wait(lock, [] { return outbox.empty(); });
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (count > 0) {
+        cout << campusName << " -> " << targetCampus << ": " << count << " messages in " << seconds
+             << " s (" << static_cast<long long>(count / max(seconds, 1e-9)) << " msg/s)" << endl;
+    } else {
+        string line;
+        getline(cin, line);   // receiver: stay online until Enter or EOF
+    }
+}
+
+// Command line: --server IP --port N --udp-port N --trace-rate R --trace-file FILE
+//               --campus NAME --password PW --bench-target CAMPUS --bench-count N [--bench-window N]
+int main(int argc, char* argv[]) {
+    string campusName, password, benchTarget;
+    long long benchCount = 0;
+    size_t benchWindow = BENCH_WINDOW;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        string value = argv[i + 1];
+        if (arg == "--server") serverIp = value;
+        else if (arg == "--port") tcpPort = atoi(value.c_str());
+        else if (arg == "--udp-port") udpPort = atoi(value.c_str());
+        else if (arg == "--campus") campusName = value;
+        else if (arg == "--password") password = value;
+        else if (arg == "--bench-target") benchTarget = value;
+        else if (arg == "--bench-count") benchCount = atoll(value.c_str());
+        else if (arg == "--bench-window") benchWindow = max(1, atoi(value.c_str()));
+        else if (arg == "--trace-rate") traceRate = atof(value.c_str());
+        else if (arg == "--trace-file") traceFile = value;
+        else {
+            cerr << RED << "Unknown option " << arg << RESET << endl;
+            return 1;
+        }
+    }
+    benchMode = !campusName.empty() && !password.empty();
+    if (!benchMode) {
 waitAndClear();
+    }
     #ifdef _WIN32
     WSADATA wsaData;
     if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
         cerr << RED << "WSAStartup failed" << RESET << endl;
         return 1;
     }
+    #else
+    // A server that went away must fail the send and reconnect, not kill the client
+    signal(SIGPIPE, SIG_IGN);
     #endif
     
+    if (!benchMode) {
     cout << CYAN << BOLD << "=== NU-Information Exchange System - Campus Client ===" << RESET << endl;
     
     // Get campus information
-    string campusName, password;
-    
     cout << "\n" << GREEN << "Available Campuses:" << RESET << endl;
     cout << GREEN << "1. Islamabad (NU-ISB-123)" << RESET << endl;
     cout << GREEN << "2. Lahore (NU-LHR-123)" << RESET << endl;
@@ -294,67 +950,27 @@ waitAndClear();
     
     cout << WHITE << BOLD << "Enter password: " << RESET;
     getline(cin, password);
-    
-    currentCampus = campusName;
-    
-    // Create TCP socket
-    SOCKET tcpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (tcpSocket == INVALID_SOCKET) {
-        cerr << RED << "Failed to create TCP socket" << RESET << endl;
-        return 1;
     }
     
-    // Connect to server
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = inet_addr(SERVER_IP);
-    serverAddr.sin_port = htons(TCP_PORT);
+    currentCampus = campusName;
     
+    // Connect to server and authenticate
     cout << "\n" << YELLOW << "Connecting to server..." << RESET << endl;
     
-    if (connect(tcpSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        cerr << RED << "Failed to connect to server" << RESET << endl;
-        closesocket(tcpSocket);
-        #ifdef _WIN32
-        WSACleanup();
-        #endif
-        return 1;
-    }
-    
-    cout << GREEN << "Connected to server!" << RESET << endl;
-    
-    // Send authentication
-    string authMsg = "Campus:" + campusName + ",Pass:" + password;
-    send(tcpSocket, authMsg.c_str(), authMsg.length(), 0);
+    SOCKET tcpSocket;
+    shared_ptr<FrameReader> reader;
+    ConnectResult result = connectToServer(campusName, password, tcpSocket, reader);
     
-    // Wait for authentication response
-    char buffer[BUFFER_SIZE];
-    memset(buffer, 0, BUFFER_SIZE);
-    int bytesReceived = recv(tcpSocket, buffer, BUFFER_SIZE - 1, 0);
-    
-    if (bytesReceived <= 0) {
-        cerr << RED << "Server disconnected during authentication" << RESET << endl;
-        closesocket(tcpSocket);
-        #ifdef _WIN32
-        WSACleanup();
-        #endif
-        return 1;
-    }
-    
-    string response(buffer);
-    
-    if (response == "AUTH_SUCCESS") {
+    if (result == CONNECT_OK) {
         cout << GREEN << BOLD << "Authentication successful!" << RESET << endl;
-    } else if (response == "AUTH_FAILED") {
-        cerr << RED << BOLD << "Authentication failed! Invalid credentials." << RESET << endl;
-        closesocket(tcpSocket);
-        #ifdef _WIN32
-        WSACleanup();
-        #endif
-        return 1;
-    } else if (response == "ALREADY_CONNECTED") {
-        cerr << RED << BOLD << "This campus is already connected!" << RESET << endl;
-        closesocket(tcpSocket);
+    } else {
+        if (result == AUTH_REJECTED) {
+            cerr << RED << BOLD << "Authentication failed! Invalid credentials." << RESET << endl;
+        } else if (result == CAMPUS_BUSY) {
+            cerr << RED << BOLD << "This campus is already connected!" << RESET << endl;
+        } else {
+            cerr << RED << "Failed to connect to server" << RESET << endl;
+        }
         #ifdef _WIN32
         WSACleanup();
         #endif
@@ -385,27 +1001,62 @@ waitAndClear();
     }
 
 
-    // Start background threads
+    // Start background threads, the connection first so the manager does not
+    // mistake the startup for a lost connection
+    installConnection(tcpSocket, reader);
     thread heartbeatThread(sendHeartbeat, campusName);
     thread broadcastThread(listenForBroadcasts);
-    thread messageThread(listenForMessages, tcpSocket);
+    thread managerThread(connectionManager, campusName, password);
+    thread senderThread(outboxSender);
     
     heartbeatThread.detach();
     broadcastThread.detach();
-    messageThread.detach();
+    managerThread.detach();
+    senderThread.detach();
     
+    if (benchMode) {
+        runLoadTest(campusName, benchTarget, benchCount, benchWindow);
+        isRunning = false;
+    } else {
     // Give threads time to start
     this_thread::sleep_for(chrono::seconds(1));
     
     // Run main menu
     waitAndClear();
-    displayMenu(tcpSocket, campusName);
+    displayMenu(campusName);
+    }
     
     // Cleanup
-    closesocket(tcpSocket);
+    connCv.notify_all();
+    {
+        lock_guard<mutex> sendLock(sendMutex);
+        lock_guard<mutex> lock(connMutex);
+        if (connected) {
+            connected = false;
+            closesocket(serverSocket);
+        }
+    }
+    {
+        lock_guard<mutex> lock(outboxMutex);
+        if (!outbox.empty()) {
+            cout << YELLOW << outbox.size() << " unacknowledged message(s) discarded" << RESET << endl;
+        }
+    }
     if (clientUdpSocket != INVALID_SOCKET) {
     closesocket(clientUdpSocket);
     }
+    // Export the spans we recorded as a sender (and any traced messages we received)
+    if (traceRate > 0.0 && traceFile.empty()) {
+        traceFile = "client_trace_" + campusName + ".json";
+    }
+    if (!traceFile.empty()) {
+        long long written = traceBuffer.writeChromeTrace(traceFile, "client " + campusName, traceProcessId());
+        if (written < 0) {
+            cerr << RED << "Failed to write " << traceFile << RESET << endl;
+        } else {
+            cout << GREEN << "Wrote " << written << " trace span(s) to " << traceFile << RESET << endl;
+        }
+    }
 
     #ifdef _WIN32
     WSACleanup();
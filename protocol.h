@@ -0,0 +1,269 @@
+//shared wire protocol helpers for server.cpp and client.cpp
+//include after the platform socket headers (SOCKET, recv, send must be defined)
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define PROTOCOL_X86 1
+    #include <immintrin.h>
+#endif
+#ifdef _WIN32
+    #define pollSockets WSAPoll
+#else
+    #include <poll.h>
+    #define pollSockets poll
+#endif
+
+//protocol 2 clients append ",Proto:2" to the login message. Every message is then
+//one '\n' terminated line, and a transfer chunk line is followed by LEN raw bytes:
+//  XFER_OPEN:<id>|TARGET:x|DEPT:y|FROM:z|NAME:file|SIZE:n
+//  XFER_CHUNK:<id>|SEQ:n|LEN:n  + LEN raw bytes
+//  XFER_END:<id>   XFER_ABORT:<id>   XFER_CREDIT:<id>|N:n  (server -> sender)
+//legacy clients keep the old framing where one recv is one message
+#define PROTOCOL_VERSION 2
+#define FRAME_RECV_SIZE 4096
+#define MAX_LINE_LENGTH 65536   //longest accepted text line
+#define TRANSFER_CHUNK_SIZE 8192
+#define TRANSFER_WINDOW 8       //chunks a sender may have in flight per transfer
+
+//value of "|KEY:" (or a leading "KEY:") up to the next '|', empty if absent
+inline std::string protocolField(const std::string& line, const std::string& key) {
+    size_t start;
+    if (line.compare(0, key.length() + 1, key + ":") == 0) {
+        start = key.length() + 1;
+    } else {
+        size_t pos = line.find("|" + key + ":");
+        if (pos == std::string::npos) return "";
+        start = pos + key.length() + 2;
+    }
+    size_t end = line.find('|', start);
+    return line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+//routing header of a campus message, fields in this order:
+//  TARGET:x|DEPT:y|FROM:z[|PRI:p][|ID:n][|TRACE:t]|MSG:payload
+//the views point into the parsed message and the payload is never scanned,
+//so payload text like "|FROM:" or "ACK:" cannot be mistaken for header
+struct RouteHeader {
+    std::string_view target;
+    std::string_view dept;
+    std::string_view from;
+    std::string_view priority;   //empty when absent
+    std::string_view id;
+    std::string_view trace;
+    std::string_view msg;
+};
+
+//offset of the first '|' in data, or length when there is none
+typedef size_t (*DelimiterScan)(const char* data, size_t length);
+
+inline size_t scanDelimiterScalar(const char* data, size_t length) {
+    const void* found = memchr(data, '|', length);
+    return found ? static_cast<size_t>(static_cast<const char*>(found) - data) : length;
+}
+
+#ifdef PROTOCOL_X86
+//16 bytes per compare, SSE2 is part of every x86-64 CPU
+inline size_t scanDelimiterSse2(const char* data, size_t length) {
+    const __m128i bar = _mm_set1_epi8('|');
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, bar));
+        if (mask != 0) {
+            unsigned bits = static_cast<unsigned>(mask);
+            size_t offset = 0;
+            while (!(bits & 1)) {
+                bits >>= 1;
+                offset++;
+            }
+            return i + offset;
+        }
+    }
+    return i + scanDelimiterScalar(data + i, length - i);
+}
+
+#if defined(__GNUC__)
+//32 bytes per compare, only called after the CPU reported AVX2
+__attribute__((target("avx2")))
+inline size_t scanDelimiterAvx2(const char* data, size_t length) {
+    const __m256i bar = _mm256_set1_epi8('|');
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, bar)));
+        if (mask != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+    }
+    return i + scanDelimiterSse2(data + i, length - i);
+}
+#endif
+#endif
+
+//scanners this build and CPU can run, best first; the first is used by parseRouteHeader
+struct DelimiterScanner {
+    const char* name;
+    DelimiterScan scan;
+};
+
+inline int availableDelimiterScanners(DelimiterScanner scanners[3]) {
+    int count = 0;
+#ifdef PROTOCOL_X86
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) scanners[count++] = DelimiterScanner{"avx2", scanDelimiterAvx2};
+#endif
+    scanners[count++] = DelimiterScanner{"sse2", scanDelimiterSse2};
+#endif
+    scanners[count++] = DelimiterScanner{"scalar", scanDelimiterScalar};
+    return count;
+}
+
+inline DelimiterScan bestDelimiterScan() {
+    static const DelimiterScan best = [] {
+        DelimiterScanner scanners[3];
+        availableDelimiterScanners(scanners);
+        return scanners[0].scan;
+    }();
+    return best;
+}
+
+//single pass over the header with strict field order; false if the message is
+//not a routed message or a field is missing, repeated or out of place
+inline bool parseRouteHeader(std::string_view message, RouteHeader& header, DelimiterScan scan = nullptr) {
+    static const std::string_view keys[] = {"TARGET:", "DEPT:", "FROM:", "PRI:", "ID:", "TRACE:", "MSG:"};
+    std::string_view* fields[] = {&header.target, &header.dept, &header.from, &header.priority,
+                                  &header.id, &header.trace, &header.msg};
+    const int required = 3;   //TARGET, DEPT and FROM; PRI, ID and TRACE are optional
+    const int msgField = 6;
+    if (scan == nullptr) scan = bestDelimiterScan();
+    header = RouteHeader();
+    size_t pos = 0;
+    int next = 0;   //lowest field index still allowed
+    while (true) {
+        int field = next;
+        while (field <= msgField && message.compare(pos, keys[field].length(), keys[field]) != 0) {
+            if (field < required) return false;   //required fields cannot be skipped
+            field++;
+        }
+        if (field > msgField) return false;
+        pos += keys[field].length();
+        if (field == msgField) {
+            header.msg = message.substr(pos);
+            return true;
+        }
+        size_t end = pos + scan(message.data() + pos, message.length() - pos);
+        if (end >= message.length()) return false;   //no MSG field
+        *fields[field] = message.substr(pos, end - pos);
+        pos = end + 1;
+        next = field + 1;
+    }
+}
+
+//send the whole buffer, looping over partial sends
+inline bool sendAll(SOCKET sock, const char* data, size_t length) {
+    while (length > 0) {
+        int sent = send(sock, data, static_cast<int>(length), 0);
+        if (sent == SOCKET_ERROR || sent == 0) return false;
+        data += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+inline bool sendAll(SOCKET sock, const std::string& data) {
+    return sendAll(sock, data.c_str(), data.length());
+}
+
+//wait up to timeoutMs for the socket to become readable (or fail); > 0 when ready
+inline int waitReadable(SOCKET sock, int timeoutMs) {
+    pollfd entry;
+    entry.fd = sock;
+    entry.events = POLLIN;
+    entry.revents = 0;
+    return pollSockets(&entry, 1, timeoutMs);
+}
+
+//buffered reader for one TCP connection: lines, raw blocks, or legacy recv-sized messages
+class FrameReader {
+public:
+    explicit FrameReader(SOCKET sock) : sock(sock) {}
+    //resume a connection whose unread bytes were buffered by someone else
+    FrameReader(SOCKET sock, std::string pending) : sock(sock), buffer(std::move(pending)) {}
+
+    //true once a message can be read without waiting longer than timeoutMs
+    //(also true on disconnect, so the next read reports it)
+    bool waitReadable(int timeoutMs) {
+        return buffer.length() > offset || ::waitReadable(sock, timeoutMs) > 0;
+    }
+
+    //bytes received but not read yet
+    std::string pending() const {
+        return buffer.substr(offset);
+    }
+
+    //next line without its terminator; false on disconnect or an overlong line
+    bool readLine(std::string& line) {
+        while (true) {
+            size_t newline = buffer.find('\n', offset);
+            if (newline != std::string::npos) {
+                size_t end = newline;
+                if (end > offset && buffer[end - 1] == '\r') end--;
+                line.assign(buffer, offset, end - offset);
+                offset = newline + 1;
+                compact();
+                return true;
+            }
+            if (buffer.length() - offset > MAX_LINE_LENGTH) return false;
+            if (!fill()) return false;
+        }
+    }
+
+    //exactly length raw bytes
+    bool readBlock(size_t length, std::string& block) {
+        while (buffer.length() - offset < length) {
+            if (!fill()) return false;
+        }
+        block.assign(buffer, offset, length);
+        offset += length;
+        compact();
+        return true;
+    }
+
+    //legacy framing: whatever is buffered, or the result of one recv
+    bool readAvailable(std::string& message) {
+        if (buffer.length() == offset && !fill()) return false;
+        message.assign(buffer, offset, std::string::npos);
+        buffer.clear();
+        offset = 0;
+        return true;
+    }
+
+private:
+    SOCKET sock;
+    std::string buffer;
+    size_t offset = 0;
+
+    bool fill() {
+        char chunk[FRAME_RECV_SIZE];
+        int received = recv(sock, chunk, FRAME_RECV_SIZE, 0);
+        if (received <= 0) return false;
+        buffer.append(chunk, static_cast<size_t>(received));
+        return true;
+    }
+
+    void compact() {
+        if (offset == buffer.length()) {
+            buffer.clear();
+            offset = 0;
+        } else if (offset > FRAME_RECV_SIZE && offset * 2 > buffer.length()) {
+            buffer.erase(0, offset);
+            offset = 0;
+        }
+    }
+};
+
+#endif
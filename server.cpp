@@ -9,6 +9,17 @@
 #include <sstream>
 #include <iomanip>
 #include <limits>
+#include <deque>
+#include <condition_variable>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <fstream>
+#include <random>
+#include <csignal>
+#include <cstdint>
+#include <unordered_set>
 
 using namespace std;
 
@@ -27,11 +38,52 @@ using namespace std;
     #define INVALID_SOCKET -1
     #define SOCKET_ERROR -1
     #define closesocket close
+    #include <sys/un.h>
+    #include <sys/stat.h>
+    #include <pthread.h>
+    #define SD_BOTH SHUT_RDWR
 #endif
 
+#include "protocol.h"
+#include "tracing.h"
+
 #define TCP_PORT 8080
 #define UDP_PORT 8081
 #define BUFFER_SIZE 4096
+//default rate limits (messages per second / burst size), overridable from the command line
+#define SOURCE_RATE 20.0
+#define SOURCE_BURST 40.0
+#define TARGET_RATE 50.0
+#define TARGET_BURST 100.0
+#define DRR_QUANTUM 4096        //bytes a source may route per scheduling round
+#define ROUTE_QUEUE_LIMIT 64    //max pending routes per source campus
+#define RATE_LOG_INTERVAL_MS 1000 //at most one rate limit (or duplicate) warning per campus per interval
+//route workers: every campus is owned by one worker chosen by its name
+#define ROUTE_WORKERS 1         //default worker count
+#define WORKER_INBOX_SIZE 1024  //max slots per worker-to-worker queue (power of two)
+#define WORKER_INBOX_MIN 64     //min slots per worker-to-worker queue (power of two)
+#define WORKER_INBOX_BUDGET 4096 //slots per worker shared by its inboxes, the backlog absorbs bursts
+#define WORKER_BACKLOG_POLL_MS 1 //retry interval while another worker's inbox is full
+#define ROUTE_DELIVER 0         //worker item: deliver to a campus the receiver owns
+#define ROUTE_REPLY 1           //worker item: ACK/ERROR for a source campus the receiver owns
+//outbound priority lanes per campus connection
+#define LANE_URGENT 0           //control replies, broadcasts and PRI:URGENT messages
+#define LANE_BULK 1             //everything else
+#define LANE_COUNT 2
+#define URGENT_WEIGHT 8         //urgent sends per bulk send when both lanes are busy
+#define OUTBOUND_LANE_LIMIT 256 //max queued routed messages per lane before delivery fails
+#define DEDUP_WINDOW 4096       //recent message ids per source tracked by the sliding bitmap
+#define DEDUP_FALLBACK_LIMIT 1024   //late ids below the window remembered per source
+#define MAX_TRANSFERS_PER_CAMPUS 4 //open outgoing transfers per campus (bounds relay memory)
+#define CREDENTIALS_FILE "credentials.txt"
+//federation between hub processes
+#define PEER_PORT 9100          //hub-to-hub link port
+#define PEER_RETRY_MS 1000      //redial interval for a dropped hub link
+#define PEER_LANE_LIMIT 4096    //queued forwards per hub link lane
+//handing the live server over to a new process
+#define HANDOFF_POLL_MS 200     //how often blocked threads look for a handoff
+#define HANDOFF_DRAIN_MS 2000   //max wait for handlers to park and queues to drain
+#define CREDENTIAL_SALT_BYTES 16
 //just some things for terminal design
 #define RESET   "\033[0m"
 #define BOLD    "\033[1m"
@@ -57,29 +109,497 @@ using namespace std;
 mutex clientMutex;
 mutex consoleMutex;
 
+const char* laneNames[LANE_COUNT] = {"URGENT", "BULK"};
+
+//one queued outbound message and when it was queued (for lane latency)
+struct OutboundItem {
+    string data;
+    chrono::steady_clock::time_point queuedAt;
+    function<void()> onSent;   //runs on the writer thread once the data is on the socket
+    unsigned long long traceId = 0;   //sampled message, the writer records its spans
+};
+
+//outbound lanes of one campus connection, drained by its writer thread
+struct Outbound {
+    mutex lock;
+    condition_variable ready;
+    deque<OutboundItem> lanes[LANE_COUNT];
+    bool closed = false;
+    bool framed = false;       //protocol 2 connection, messages are '\n' terminated
+    bool handedOff = false;    //closed for a handoff: the writer leaves the socket open
+    bool writerDone = false;
+    int worker = -1;           //route worker owning the campus, -1 for hub links
+    atomic<long long> lastSeenMicros{0};   //last heartbeat or TCP message from the campus
+};
+
+//a streaming transfer being relayed; at most TRANSFER_WINDOW chunks of it are
+//ever buffered because the sender only gets a credit back once a chunk is sent
+struct Transfer {
+    string sourceCampus;
+    string targetCampus;
+    string id;
+    unsigned inFlight = 0;
+    shared_ptr<Outbound> sourceOut;
+    shared_ptr<Outbound> targetOut;
+};
+
 //to hold campus client info
 struct CampusClient {
     SOCKET tcpSocket;
     string campusName;
-    string lastHeartbeat;
+    string lastHeartbeat;      //last seen (HH:MM:SS) when there is no live connection, see lastSeenOf
     bool isActive;
     sockaddr_in udpAddr;
     bool hasUdpAddr = false;
+    shared_ptr<Outbound> outbound;
+};
+
+//queue-to-socket latency per lane, log2 buckets with 4 linear steps each (microseconds)
+struct LatencyHistogram {
+    static const int BUCKETS = 160;
+    atomic<unsigned long long> counts[BUCKETS];
+    atomic<unsigned long long> total;
+    atomic<long long> maxMicros;
+
+    static int bucketFor(long long micros) {
+        if (micros < 4) return static_cast<int>(max(0LL, micros));
+        int msb = 63 - __builtin_clzll(static_cast<unsigned long long>(micros));
+        int sub = static_cast<int>((micros >> (msb - 2)) & 3);
+        return min(BUCKETS - 1, (msb - 1) * 4 + sub);
+    }
+    static long long bucketUpper(int bucket) {
+        if (bucket < 4) return bucket;
+        int msb = bucket / 4 + 1;
+        long long step = 1LL << (msb - 2);
+        return (4 + bucket % 4) * step + step - 1;
+    }
+    void record(long long micros) {
+        counts[bucketFor(micros)]++;
+        total++;
+        long long seen = maxMicros;
+        while (micros > seen && !maxMicros.compare_exchange_weak(seen, micros)) {}
+    }
+    long long percentile(double p) const {
+        unsigned long long n = total;
+        if (n == 0) return 0;
+        unsigned long long rank = static_cast<unsigned long long>(p * n);
+        unsigned long long seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen > rank) return min(bucketUpper(i), static_cast<long long>(maxMicros));
+        }
+        return maxMicros;
+    }
+    //add the samples of another histogram (per-worker histograms are summed for display)
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        maxMicros = max(maxMicros.load(), other.maxMicros.load());
+    }
 };
 
+bool strictLanes = false;            //strict priority instead of weighted
+unsigned urgentWeight = URGENT_WEIGHT;
+
+//sampled tracing: messages tagged |TRACE: by their sender, plus traceRate of untagged ones
+TraceBuffer traceBuffer;
+double traceRate = 0.0;
+string traceFile = "server_trace.json";
+
 //map to store connected campus clients (campusName -> CampusClient)
 map<string, CampusClient> connectedClients;
 
-//campus id pass
-map<string, string> validCredentials = {
-    {"Islamabad", "NU-ISB-123"},
-    {"Lahore", "NU-LHR-123"},
-    {"Karachi", "NU-KHI-123"},
-    {"Peshawar", "NU-PEW-123"},
-    {"CFD", "NU-CFD-123"},
-    {"Multan", "NU-MLT-123"}
+//token bucket used for per-source and per-target rate limiting
+struct TokenBucket {
+    double tokens;
+    double rate;
+    double burst;
+    chrono::steady_clock::time_point lastRefill;
+
+    TokenBucket(double r = SOURCE_RATE, double b = SOURCE_BURST)
+        : tokens(b), rate(r), burst(b), lastRefill(chrono::steady_clock::now()) {}
+
+    void refill(chrono::steady_clock::time_point now) {
+        double elapsed = chrono::duration<double>(now - lastRefill).count();
+        tokens = min(burst, tokens + elapsed * rate);
+        lastRefill = now;
+    }
+    //milliseconds until one token is available again
+    long long retryAfterMs() const {
+        if (tokens >= 1.0 || rate <= 0) return 0;
+        return static_cast<long long>((1.0 - tokens) / rate * 1000.0) + 1;
+    }
+};
+
+struct DedupWindow;
+
+//one message waiting to be routed
+struct RouteJob {
+    string sourceCampus;   //authenticated sender (not the FROM field)
+    string targetCampus;
+    string message;
+    int lane;
+    string messageId;      //optional |ID: echoed in the ACK/ERROR reply
+    unsigned long long traceId = 0;
+    long long queuedMicros = 0;   //when it entered the route queue
+    shared_ptr<DedupWindow> dedup = nullptr;   //sender's window, set when messageId is tracked there
+    unsigned long long dedupId = 0;
+};
+
+//message ids already routed for one source campus: a bitmap over the newest
+//DEDUP_WINDOW ids plus a small FIFO-bounded set for stragglers below it. Clients
+//number messages increasingly and keep at most OUTBOX_LIMIT (1000) unacknowledged,
+//so every retry they can make lands inside the window. An id stays pending until
+//its delivery is confirmed, a retry of it before then gets no answer of its own
+struct DedupWindow {
+    mutex lock;
+    bool started = false;
+    unsigned long long highest = 0;      //window covers (highest - DEDUP_WINDOW, highest]
+    uint64_t bits[DEDUP_WINDOW / 64] = {};
+    unordered_set<unsigned long long> older;
+    deque<unsigned long long> olderOrder;   //eviction order of older
+    unordered_set<unsigned long long> pending;   //routed but not answered yet
+
+    bool inWindow(unsigned long long id) const {
+        return started && id <= highest && highest - id < DEDUP_WINDOW;
+    }
+
+    bool testBit(unsigned long long id) const {
+        return (bits[(id % DEDUP_WINDOW) / 64] >> (id % 64)) & 1;
+    }
+
+    void setBit(unsigned long long id, bool value) {
+        uint64_t mask = uint64_t(1) << (id % 64);
+        uint64_t& word = bits[(id % DEDUP_WINDOW) / 64];
+        word = value ? (word | mask) : (word & ~mask);
+    }
+
+    bool contains(unsigned long long id) const {
+        if (started && id > highest) return false;
+        return inWindow(id) ? testBit(id) : older.count(id) > 0;
+    }
+
+    void insert(unsigned long long id) {
+        if (!started || id > highest) {
+            //slide forward, clearing the slots of the ids the window now covers
+            if (!started || id - highest >= DEDUP_WINDOW) {
+                memset(bits, 0, sizeof(bits));
+            } else {
+                for (unsigned long long next = highest + 1; next < id; next++) setBit(next, false);
+            }
+            started = true;
+            highest = id;
+            setBit(id, true);
+        } else if (inWindow(id)) {
+            setBit(id, true);
+        } else if (older.insert(id).second) {
+            olderOrder.push_back(id);
+            if (olderOrder.size() > DEDUP_FALLBACK_LIMIT) {
+                older.erase(olderOrder.front());
+                olderOrder.pop_front();
+            }
+        }
+    }
+
+    //delivery failed for good, a retry must be routed again
+    void erase(unsigned long long id) {
+        pending.erase(id);
+        if (inWindow(id)) {
+            setBit(id, false);
+        } else {
+            older.erase(id);
+        }
+    }
+};
+
+//dedup state per source campus, kept across reconnects
+mutex dedupMutex;
+map<string, shared_ptr<DedupWindow>> dedupWindows;
+
+//pending routes of one source campus for deficit round robin
+struct SourceQueue {
+    deque<RouteJob> jobs;
+    size_t deficit = 0;
+    bool scheduled = false;
+};
+
+double sourceRate = SOURCE_RATE;
+double sourceBurst = SOURCE_BURST;
+double targetRate = TARGET_RATE;
+double targetBurst = TARGET_BURST;
+size_t drrQuantum = DRR_QUANTUM;
+
+//per-lane route queues; urgent routes are always scheduled before bulk ones
+struct RouteLane {
+    map<string, SourceQueue> queues;
+    deque<string> activeSources;   //round robin order of sources with pending routes
+};
+
+//bounded single-producer/single-consumer ring between two route workers: only
+//the producer writes tail and only the consumer writes head, so neither locks
+template <typename T>
+struct SpscQueue {
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0};   //next slot to pop
+    alignas(64) atomic<size_t> tail{0};   //next slot to push
+
+    explicit SpscQueue(size_t capacity) : slots(capacity), mask(capacity - 1) {}   //power of two
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+    //moves item in only on success
+    bool push(T& item) {
+        size_t next = tail.load(memory_order_relaxed);
+        if (next - head.load(memory_order_acquire) == slots.size()) return false;
+        slots[next & mask] = move(item);
+        tail.store(next + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t next = head.load(memory_order_relaxed);
+        if (next == tail.load(memory_order_acquire)) return false;
+        item = move(slots[next & mask]);
+        head.store(next + 1, memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(memory_order_seq_cst) == tail.load(memory_order_seq_cst);
+    }
+};
+
+//a route passed between workers; for ROUTE_REPLY the message is the reply text
+struct WorkerItem {
+    int kind = ROUTE_DELIVER;
+    RouteJob job;
+};
+
+//a route worker owns the campuses whose name hashes to it: it schedules their
+//routes, delivers to them and answers them. Routes and replies cross between
+//workers only through the inboxes, never through another worker's campus table
+struct RouteWorker {
+    int index = 0;
+    int cpu = -1;                       //pinned CPU, -1 when not pinned
+    mutex routeMutex;                   //route lanes, routing and the wake handshake
+    condition_variable wake;
+    RouteLane routeLanes[LANE_COUNT];
+    bool routing = false;               //handling a batch or holding a backlog (routeMutex)
+    atomic<bool> sleeping{false};       //waiting on wake, an inbox producer must notify
+    vector<unique_ptr<SpscQueue<WorkerItem>>> inbox;   //by sending worker, null for itself
+    vector<deque<WorkerItem>> backlog;  //by receiving worker, items its full inbox refused
+    mutex campusMutex;                  //campuses, taken by this worker and on (dis)connect
+    map<string, shared_ptr<Outbound>> campuses;
+    mutex rateMutex;                    //buckets of the owned campuses
+    map<string, TokenBucket> sourceBuckets;
+    map<string, TokenBucket> targetBuckets;
+    LatencyHistogram laneLatency[LANE_COUNT];   //sends to owned campuses (worker 0: hub links too)
+};
+
+vector<unique_ptr<RouteWorker>> routeWorkers;
+size_t workerCount = 0;      //0 until parsed: one per --worker-cpus entry, else ROUTE_WORKERS
+vector<int> workerCpus;
+
+mutex transferMutex;
+map<string, Transfer> transfers;   //"source/id" -> relayed transfer
+
+//federation: hubs form a full mesh of persistent TCP links, each hub owns the
+//campuses that log in to it and tells its peers where they are
+struct HubPeer {
+    int id;
+    string host;
+    int port;
+};
+
+//a routed message handed to another hub, answered by FWD_ACK
+struct PendingForward {
+    string sourceCampus;
+    string targetCampus;
+    string messageId;
+    int hub;
+    shared_ptr<DedupWindow> dedup;
+    unsigned long long dedupId = 0;
+};
+
+int hubId = 0;
+int tcpPort = TCP_PORT;
+int udpPort = UDP_PORT;
+int peerPort = PEER_PORT;
+vector<HubPeer> hubPeers;
+SOCKET broadcastSocket = INVALID_SOCKET;
+
+mutex hubMutex;
+map<int, shared_ptr<Outbound>> peerLinks;   //hub id -> live link
+map<string, int> campusLocations;           //campus attached to another hub -> hub id
+map<unsigned long long, PendingForward> pendingForwards;
+unsigned long long nextForwardSeq = 1;
+unsigned long long nextBroadcastSeq = 1;
+
+//handoff: the running server passes its listening sockets and campus connections
+//to a new process (--takeover) over a Unix socket; campus handlers park at a
+//message boundary so no half-read message is lost
+struct ParkedConnection {
+    string campusName;
+    SOCKET socket;
+    shared_ptr<Outbound> outbound;
+    string pending;    //bytes read from the socket but not handled yet
 };
 
+string handoffPath;
+string takeoverPath;
+SOCKET tcpListenSocket = INVALID_SOCKET;
+SOCKET heartbeatSocket = INVALID_SOCKET;
+SOCKET peerListenSocket = INVALID_SOCKET;
+atomic<bool> handoffActive(false);
+mutex handoffMutex;
+condition_variable handoffCv;
+int servingHandlers = 0;   //campus handlers in their serve loop
+vector<ParkedConnection> parkedConnections;
+
+//SHA-256 (FIPS 180-4) for salted credential digests
+struct Sha256 {
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block[64];
+    size_t blockLength = 0;
+    uint64_t totalLength = 0;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void transform() {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+                   (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    void update(const void* data, size_t length) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        totalLength += length;
+        while (length > 0) {
+            size_t take = min(length, sizeof(block) - blockLength);
+            memcpy(block + blockLength, bytes, take);
+            blockLength += take;
+            bytes += take;
+            length -= take;
+            if (blockLength == sizeof(block)) {
+                transform();
+                blockLength = 0;
+            }
+        }
+    }
+
+    void finish(unsigned char digest[32]) {
+        uint64_t bits = totalLength * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (blockLength != 56) update(&pad, 1);
+        for (int i = 7; i >= 0; i--) {
+            unsigned char byte = static_cast<unsigned char>(bits >> (i * 8));
+            update(&byte, 1);
+        }
+        for (int i = 0; i < 8; i++) {
+            digest[i * 4] = static_cast<unsigned char>(state[i] >> 24);
+            digest[i * 4 + 1] = static_cast<unsigned char>(state[i] >> 16);
+            digest[i * 4 + 2] = static_cast<unsigned char>(state[i] >> 8);
+            digest[i * 4 + 3] = static_cast<unsigned char>(state[i]);
+        }
+    }
+};
+
+//one campus login: SHA-256(salt || password), never the password itself
+struct Credential {
+    string campusName;
+    unsigned char salt[CREDENTIAL_SALT_BYTES];
+    unsigned char digest[32];
+};
+
+//immutable open-addressing (linear probing) index over the credential file;
+//kept at most half full so lookups stay O(1) at 100k+ campuses
+struct CredentialIndex {
+    struct Slot {
+        uint64_t hash = 0;
+        uint32_t entry = 0;   //index into entries + 1, 0 = empty
+    };
+    vector<Credential> entries;
+    vector<Slot> slots;
+    size_t mask = 0;
+
+    static uint64_t hashName(const string& name) {
+        uint64_t hash = 1469598103934665603ULL;   //FNV-1a
+        for (unsigned char c : name) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    explicit CredentialIndex(vector<Credential> credentials) : entries(move(credentials)) {
+        size_t capacity = 16;
+        while (capacity < entries.size() * 2) capacity <<= 1;
+        slots.resize(capacity);
+        mask = capacity - 1;
+        for (size_t i = 0; i < entries.size(); i++) {
+            uint64_t hash = hashName(entries[i].campusName);
+            size_t slot = hash & mask;
+            //a repeated campus name keeps its last line
+            while (slots[slot].entry != 0 &&
+                   !(slots[slot].hash == hash && entries[slots[slot].entry - 1].campusName == entries[i].campusName)) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot].hash = hash;
+            slots[slot].entry = static_cast<uint32_t>(i + 1);
+        }
+    }
+
+    const Credential* find(const string& campusName) const {
+        uint64_t hash = hashName(campusName);
+        for (size_t slot = hash & mask; slots[slot].entry != 0; slot = (slot + 1) & mask) {
+            const Credential& credential = entries[slots[slot].entry - 1];
+            if (slots[slot].hash == hash && credential.campusName == campusName) {
+                return &credential;
+            }
+        }
+        return nullptr;
+    }
+};
+
+//current credential index, swapped atomically on reload so logins never wait for it
+shared_ptr<const CredentialIndex> credentialStore;
+string credentialPath = CREDENTIALS_FILE;
+mutex reloadMutex;
+volatile sig_atomic_t reloadRequested = 0;
+
 void enableANSI() {
     #ifdef _WIN32
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -161,66 +681,1240 @@ void printLog(const string& message, const string& type = "INFO") {
               << " " << WHITE << message << RESET << endl;
 }
 
-//authenticating(client logging in)
-bool authenticateClient(const string& authMsg, string& campusName) {
-    size_t campusPos = authMsg.find("Campus:");
-    size_t passPos = authMsg.find(",Pass:");
-    if (campusPos == string::npos || passPos == string::npos) {
-        return false;
+string toHex(const unsigned char* bytes, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    hex.reserve(length * 2);
+    for (size_t i = 0; i < length; i++) {
+        hex += digits[bytes[i] >> 4];
+        hex += digits[bytes[i] & 15];
+    }
+    return hex;
+}
+
+bool fromHex(const char* hex, size_t hexLength, unsigned char* bytes, size_t length) {
+    if (hexLength != length * 2) return false;
+    for (size_t i = 0; i < hexLength; i++) {
+        char c = hex[i];
+        int value = c >= '0' && c <= '9' ? c - '0' :
+                    c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (value < 0) return false;
+        if (i % 2 == 0) bytes[i / 2] = static_cast<unsigned char>(value << 4);
+        else bytes[i / 2] |= static_cast<unsigned char>(value);
+    }
+    return true;
+}
+
+void hashSecret(const unsigned char* salt, const string& password, unsigned char digest[32]) {
+    Sha256 sha;
+    sha.update(salt, CREDENTIAL_SALT_BYTES);
+    sha.update(password.data(), password.length());
+    sha.finish(digest);
+}
+
+//credential file line for a campus ("campus:salthex:digesthex") with a fresh random salt
+string makeCredentialLine(const string& campusName, const string& password) {
+    random_device random;
+    unsigned char salt[CREDENTIAL_SALT_BYTES];
+    for (auto& byte : salt) byte = static_cast<unsigned char>(random());
+    unsigned char digest[32];
+    hashSecret(salt, password, digest);
+    return campusName + ":" + toHex(salt, sizeof(salt)) + ":" + toHex(digest, sizeof(digest));
+}
+
+//parse the credential file in one pass; '#' starts a comment line
+shared_ptr<const CredentialIndex> loadCredentials(const string& path, string& error) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    vector<Credential> credentials;
+    credentials.reserve(static_cast<size_t>(count(contents.begin(), contents.end(), '\n')) + 1);
+    size_t badLines = 0;
+    size_t lineStart = 0;
+    while (lineStart < contents.length()) {
+        size_t lineEnd = contents.find('\n', lineStart);
+        if (lineEnd == string::npos) lineEnd = contents.length();
+        size_t end = lineEnd;
+        if (end > lineStart && contents[end - 1] == '\r') end--;
+        if (end > lineStart && contents[lineStart] != '#') {
+            size_t saltStart = contents.find(':', lineStart);
+            size_t digestStart = saltStart < end ? contents.find(':', saltStart + 1) : string::npos;
+            Credential credential;
+            if (saltStart > lineStart && digestStart < end &&
+                fromHex(&contents[saltStart + 1], digestStart - saltStart - 1, credential.salt, CREDENTIAL_SALT_BYTES) &&
+                fromHex(&contents[digestStart + 1], end - digestStart - 1, credential.digest, 32)) {
+                credential.campusName.assign(contents, lineStart, saltStart - lineStart);
+                credentials.push_back(move(credential));
+            } else {
+                badLines++;
+            }
+        }
+        lineStart = lineEnd + 1;
+    }
+    if (badLines > 0) {
+        printLog("Skipped " + to_string(badLines) + " malformed line(s) in " + path, "WARNING");
+    }
+    return make_shared<const CredentialIndex>(move(credentials));
+}
+
+//build a new index off to the side and swap it in; logins keep using the old
+//index until the swap and connected campuses are not touched
+bool reloadCredentials() {
+    lock_guard<mutex> lock(reloadMutex);
+    auto started = chrono::steady_clock::now();
+    string error;
+    shared_ptr<const CredentialIndex> index = loadCredentials(credentialPath, error);
+    if (!index) {
+        printLog("Credential reload failed (" + error + "), keeping current credentials", "ERROR");
+        return false;
+    }
+    atomic_store(&credentialStore, index);
+    long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    printLog("Loaded " + to_string(index->entries.size()) + " campus credential(s) from " + credentialPath +
+             " in " + to_string(ms) + " ms", "SUCCESS");
+    return true;
+}
+
+void onReloadSignal(int) {
+    reloadRequested = 1;
+}
+
+//reloads requested by SIGHUP are done here, outside the signal handler
+void credentialReloadWatcher() {
+    while (true) {
+        this_thread::sleep_for(chrono::milliseconds(200));
+        if (reloadRequested) {
+            reloadRequested = 0;
+            reloadCredentials();
+        }
+    }
+}
+
+//authenticating(client logging in), "Campus:x,Pass:y[,Proto:n]"
+bool authenticateClient(const string& authMsg, string& campusName, int& protocol) {
+    size_t campusPos = authMsg.find("Campus:");
+    size_t passPos = authMsg.find(",Pass:");
+    if (campusPos == string::npos || passPos == string::npos) {
+        return false;
+    }
+    size_t protoPos = authMsg.find(",Proto:", passPos);
+    protocol = 1;
+    if (protoPos != string::npos) {
+        protocol = atoi(authMsg.c_str() + protoPos + 7);
+    }
+    campusName = authMsg.substr(campusPos + 7, passPos - campusPos - 7);
+    string password = authMsg.substr(passPos + 6, protoPos == string::npos ? string::npos : protoPos - passPos - 6);
+    shared_ptr<const CredentialIndex> store = atomic_load(&credentialStore);
+    const Credential* credential = store ? store->find(campusName) : nullptr;
+    if (!credential) {
+        return false;
+    }
+    unsigned char digest[32];
+    hashSecret(credential->salt, password, digest);
+    unsigned char diff = 0;   //constant time compare
+    for (int i = 0; i < 32; i++) {
+        diff |= digest[i] ^ credential->digest[i];
+    }
+    return diff == 0;
+}
+
+//pin the calling thread to one CPU; false where affinity is unsupported or refused
+bool pinThread(int cpu) {
+    #ifdef _WIN32
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+    #elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    #else
+    return false;
+    #endif
+}
+
+//the route worker owning a campus, by a stable hash of its name
+size_t workerIndexOf(const string& campusName) {
+    return CredentialIndex::hashName(campusName) % routeWorkers.size();
+}
+
+RouteWorker& workerOf(const string& campusName) {
+    return *routeWorkers[workerIndexOf(campusName)];
+}
+
+//connection threads of a campus run on its worker's CPU so its state stays in one cache
+void pinToWorker(int worker) {
+    if (worker >= 0 && routeWorkers[worker]->cpu >= 0) {
+        pinThread(routeWorkers[worker]->cpu);
+    }
+}
+//queue a message on a connection lane unless that lane already holds limit items
+bool queueLine(const shared_ptr<Outbound>& outbound, int lane, const string& data,
+               function<void()> onSent, unsigned long long traceId, size_t limit) {
+    {
+        lock_guard<mutex> lock(outbound->lock);
+        if (outbound->closed) return false;
+        if (outbound->lanes[lane].size() >= limit) return false;
+        outbound->lanes[lane].push_back(OutboundItem{outbound->framed ? data + "\n" : data,
+                                                     chrono::steady_clock::now(), move(onSent), traceId});
+    }
+    outbound->ready.notify_one();
+    return true;
+}
+
+//queue a server message (reply, broadcast); only the urgent lane may exceed the lane limit
+bool queueOutbound(const shared_ptr<Outbound>& outbound, int lane, const string& data,
+                   function<void()> onSent = nullptr, unsigned long long traceId = 0) {
+    return queueLine(outbound, lane, data, move(onSent), traceId,
+                     lane == LANE_URGENT ? SIZE_MAX : OUTBOUND_LANE_LIMIT);
+}
+
+//queue a message routed from a campus; any campus can mark its messages URGENT,
+//so both lanes are capped and a receiver that stops reading makes delivery fail
+bool queueRouted(const shared_ptr<Outbound>& outbound, int lane, const string& data,
+                 unsigned long long traceId = 0) {
+    return queueLine(outbound, lane, data, nullptr, traceId, OUTBOUND_LANE_LIMIT);
+}
+
+//queue a raw, already framed payload (transfer chunks, hub forwards) with its own lane limit
+bool queueFrame(const shared_ptr<Outbound>& outbound, int lane, string frame, function<void()> onSent, size_t limit) {
+    {
+        lock_guard<mutex> lock(outbound->lock);
+        if (outbound->closed) return false;
+        if (outbound->lanes[lane].size() >= limit) return false;
+        outbound->lanes[lane].push_back(OutboundItem{move(frame), chrono::steady_clock::now(), move(onSent)});
+    }
+    outbound->ready.notify_one();
+    return true;
+}
+
+//queue a raw transfer frame on the bulk lane; chunks are bounded by transfer
+//credits instead of the lane limit and interleave with ordinary bulk messages
+bool queueTransferFrame(const shared_ptr<Outbound>& outbound, string frame, function<void()> onSent) {
+    return queueFrame(outbound, LANE_BULK, move(frame), move(onSent), SIZE_MAX);
+}
+
+//writer thread of one campus connection: drains the lanes with strict or
+//weighted priority so bulk traffic never delays urgent traffic for long
+void outboundWriter(SOCKET clientSocket, shared_ptr<Outbound> outbound) {
+    pinToWorker(outbound->worker);
+    LatencyHistogram* laneLatency = routeWorkers[max(0, outbound->worker)]->laneLatency;
+    unsigned urgentStreak = 0;
+    bool broken = false;
+    while (true) {
+        OutboundItem item;
+        int lane;
+        {
+            unique_lock<mutex> lock(outbound->lock);
+            outbound->ready.wait(lock, [&] {
+                return outbound->closed || (!broken && (!outbound->lanes[LANE_URGENT].empty() ||
+                                                        !outbound->lanes[LANE_BULK].empty()));
+            });
+            if (outbound->closed) {
+                //the writer owns the socket so nothing is sent on a closed descriptor,
+                //unless the connection is being handed to a new server process. Done
+                //under the same lock so an abandoned handoff cannot reopen it meanwhile
+                if (!outbound->handedOff) {
+                    closesocket(clientSocket);
+                }
+                outbound->writerDone = true;
+                outbound->ready.notify_all();
+                return;
+            }
+            bool urgentReady = !outbound->lanes[LANE_URGENT].empty();
+            bool bulkReady = !outbound->lanes[LANE_BULK].empty();
+            if (urgentReady && (!bulkReady || strictLanes || urgentStreak < urgentWeight)) {
+                lane = LANE_URGENT;
+                urgentStreak++;
+            } else {
+                lane = LANE_BULK;
+                urgentStreak = 0;
+            }
+            item = move(outbound->lanes[lane].front());
+            outbound->lanes[lane].pop_front();
+        }
+        long long sendStart = item.traceId ? traceNowMicros() : 0;
+        if (!sendAll(clientSocket, item.data)) {
+            //wake the reader so it runs the disconnect cleanup
+            shutdown(clientSocket, SD_BOTH);
+            broken = true;
+            continue;
+        }
+        laneLatency[lane].record(chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - item.queuedAt).count());
+        if (item.traceId) {
+            long long queuedAt = chrono::duration_cast<chrono::microseconds>(item.queuedAt.time_since_epoch()).count();
+            traceBuffer.record(item.traceId, "outbound_wait", laneNames[lane], queuedAt, sendStart);
+            traceBuffer.record(item.traceId, "socket_send", laneNames[lane], sendStart, traceNowMicros());
+        }
+        if (item.onSent) {
+            item.onSent();
+        }
+    }
+}
+
+//when a campus was last heard from, by heartbeat or TCP message (HH:MM:SS)
+string lastSeenOf(const CampusClient& client) {
+    if (!client.outbound || client.outbound->lastSeenMicros == 0) return client.lastHeartbeat;
+    auto seen = chrono::system_clock::now() -
+                chrono::microseconds(traceNowMicros() - client.outbound->lastSeenMicros);
+    time_t time = chrono::system_clock::to_time_t(chrono::time_point_cast<chrono::system_clock::duration>(seen));
+    char buffer[100];
+    strftime(buffer, sizeof(buffer), "%H:%M:%S", localtime(&time));
+    return string(buffer);
+}
+
+//send message to specific campus, routed ones are held to the lane limit on both lanes
+bool sendToClient(const string& targetCampus, const string& message, int lane = LANE_BULK,
+                  unsigned long long traceId = 0, bool routed = false) {
+    shared_ptr<Outbound> outbound;
+    long long lockStart = traceId ? traceNowMicros() : 0;
+    {
+        lock_guard<mutex> lock(clientMutex);//synchornization     
+        if (traceId) traceBuffer.record(traceId, "client_lock", laneNames[lane], lockStart, traceNowMicros());
+        auto it = connectedClients.find(targetCampus);
+        if (it == connectedClients.end() || !it->second.isActive) {
+            return false;
+        }
+        outbound = it->second.outbound;
+    }
+    return routed ? queueRouted(outbound, lane, message, traceId) : queueOutbound(outbound, lane, message, nullptr, traceId);
+}
+//numeric |ID: of a message, false for legacy or free-form ids (never deduplicated)
+bool parseMessageId(const string& messageId, unsigned long long& id) {
+    if (messageId.empty() || messageId.length() > 19) return false;
+    for (char c : messageId) {
+        if (c < '0' || c > '9') return false;
+    }
+    id = strtoull(messageId.c_str(), nullptr, 10);
+    return true;
+}
+
+shared_ptr<DedupWindow> dedupWindowOf(const string& sourceCampus) {
+    lock_guard<mutex> lock(dedupMutex);
+    shared_ptr<DedupWindow>& window = dedupWindows[sourceCampus];
+    if (!window) window = make_shared<DedupWindow>();
+    return window;
+}
+
+//a routed message could not be delivered, so its retry is not a duplicate. The
+//window travels with the job, so workers never take dedupMutex while routing
+void forgetMessage(const shared_ptr<DedupWindow>& window, unsigned long long id) {
+    if (!window) return;
+    lock_guard<mutex> lock(window->lock);
+    window->erase(id);
+}
+
+//a routed message reached its target, from now on a retry of it is acknowledged
+void settleMessage(const shared_ptr<DedupWindow>& window, unsigned long long id) {
+    if (!window) return;
+    lock_guard<mutex> lock(window->lock);
+    window->pending.erase(id);
+}
+
+//take one token from both the source and the target bucket, or none if either is empty
+bool admitRoute(const string& sourceCampus, const string& targetCampus, long long& retryMs) {
+    //each bucket lives with the worker owning its campus, std::lock orders the two locks
+    RouteWorker& sourceWorker = workerOf(sourceCampus);
+    RouteWorker& targetWorker = workerOf(targetCampus);
+    unique_lock<mutex> sourceLock(sourceWorker.rateMutex, defer_lock);
+    unique_lock<mutex> targetLock(targetWorker.rateMutex, defer_lock);
+    if (&sourceWorker == &targetWorker) {
+        sourceLock.lock();
+    } else {
+        lock(sourceLock, targetLock);
+    }
+    auto now = chrono::steady_clock::now();
+    auto src = sourceWorker.sourceBuckets.find(sourceCampus);
+    if (src == sourceWorker.sourceBuckets.end()) {
+        src = sourceWorker.sourceBuckets.emplace(sourceCampus, TokenBucket(sourceRate, sourceBurst)).first;
+    }
+    auto dst = targetWorker.targetBuckets.find(targetCampus);
+    if (dst == targetWorker.targetBuckets.end()) {
+        dst = targetWorker.targetBuckets.emplace(targetCampus, TokenBucket(targetRate, targetBurst)).first;
+    }
+    src->second.refill(now);
+    dst->second.refill(now);
+    if (src->second.tokens < 1.0 || dst->second.tokens < 1.0) {
+        retryMs = max(src->second.retryAfterMs(), dst->second.retryAfterMs());
+        return false;
+    }
+    src->second.tokens -= 1.0;
+    dst->second.tokens -= 1.0;
+    return true;
+}
+
+//queue a route on the source campus's worker, fails when the source already has too much pending
+//and then sets retryMs to how long its oldest route has waited, about what the queue needs to drain
+bool enqueueRoute(RouteJob job, long long& retryMs) {
+    RouteWorker& worker = workerOf(job.sourceCampus);
+    {
+        lock_guard<mutex> lock(worker.routeMutex);
+        RouteLane& routeLane = worker.routeLanes[job.lane];
+        SourceQueue& queue = routeLane.queues[job.sourceCampus];
+        if (queue.jobs.size() >= ROUTE_QUEUE_LIMIT) {
+            retryMs = (traceNowMicros() - queue.jobs.front().queuedMicros) / 1000 + 1;
+            return false;
+        }
+        if (!queue.scheduled) {
+            routeLane.activeSources.push_back(job.sourceCampus);
+            queue.scheduled = true;
+        }
+        queue.jobs.push_back(move(job));
+    }
+    worker.wake.notify_one();
+    return true;
+}
+
+//hand a message for a campus on another hub to that hub's link
+bool forwardToHub(const RouteJob& job) {
+    lock_guard<mutex> lock(hubMutex);
+    auto location = campusLocations.find(job.targetCampus);
+    if (location == campusLocations.end()) return false;
+    auto link = peerLinks.find(location->second);
+    if (link == peerLinks.end()) return false;
+    unsigned long long seq = nextForwardSeq++;
+    string frame = "FWD:" + to_string(seq) + "|TARGET:" + job.targetCampus + "|SRC:" + job.sourceCampus +
+                   "|LANE:" + to_string(job.lane) + (job.traceId ? "|TRACE:" + traceIdString(job.traceId) : "") + "|LEN:" + to_string(job.message.length()) + "\n" + job.message;
+    if (!queueFrame(link->second, job.lane, move(frame), nullptr, PEER_LANE_LIMIT)) return false;
+    pendingForwards[seq] = PendingForward{job.sourceCampus, job.targetCampus, job.messageId, location->second,
+                                       job.dedup, job.dedupId};
+    return true;
+}
+
+//outbound of a campus this worker owns, null when it is not connected
+shared_ptr<Outbound> ownedOutbound(RouteWorker& worker, const string& campusName, int lane,
+                                   unsigned long long traceId) {
+    long long lockStart = traceId ? traceNowMicros() : 0;
+    lock_guard<mutex> lock(worker.campusMutex);
+    if (traceId) traceBuffer.record(traceId, "client_lock", laneNames[lane], lockStart, traceNowMicros());
+    auto it = worker.campuses.find(campusName);
+    return it == worker.campuses.end() ? nullptr : it->second;
+}
+
+void wakeWorker(RouteWorker& worker) {
+    //pairs with the fence in runRouteWorker: either it sees the item or we see it sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (worker.sleeping) {
+        { lock_guard<mutex> lock(worker.routeMutex); }
+        worker.wake.notify_one();
+    }
+}
+
+//on from's thread: push into to's inbox, or keep the item in from's backlog while
+//that inbox is full so nothing overtakes it and no worker ever blocks on another
+void passToWorker(RouteWorker& from, RouteWorker& to, WorkerItem item) {
+    deque<WorkerItem>& backlog = from.backlog[to.index];
+    if (!backlog.empty() || !to.inbox[from.index]->push(item)) {
+        backlog.push_back(move(item));
+        return;
+    }
+    wakeWorker(to);
+}
+
+//retry the backlog in order; true while some of it is still waiting
+bool flushBacklog(RouteWorker& worker) {
+    bool waiting = false;
+    for (size_t to = 0; to < worker.backlog.size(); to++) {
+        deque<WorkerItem>& backlog = worker.backlog[to];
+        bool pushed = false;
+        while (!backlog.empty() && routeWorkers[to]->inbox[worker.index]->push(backlog.front())) {
+            backlog.pop_front();
+            pushed = true;
+        }
+        if (pushed) wakeWorker(*routeWorkers[to]);
+        waiting = waiting || !backlog.empty();
+    }
+    return waiting;
+}
+
+bool inboxPending(const RouteWorker& worker) {
+    for (const auto& queue : worker.inbox) {
+        if (queue && !queue->empty()) return true;
+    }
+    return false;
+}
+
+//answer the sender of a job, through its own worker when that is another one
+void replyToSource(RouteWorker& worker, const RouteJob& job, const string& reply, unsigned long long traceId) {
+    RouteWorker& source = workerOf(job.sourceCampus);
+    if (&source == &worker) {
+        shared_ptr<Outbound> outbound = ownedOutbound(worker, job.sourceCampus, LANE_URGENT, traceId);
+        if (outbound) queueOutbound(outbound, LANE_URGENT, reply, nullptr, traceId);
+        return;
+    }
+    WorkerItem item{ROUTE_REPLY, RouteJob{job.sourceCampus, job.targetCampus, reply, LANE_URGENT, job.messageId}};
+    item.job.traceId = traceId;
+    passToWorker(worker, source, move(item));
+}
+
+//on the target campus's worker: forward one message and report the result back to the sender
+void deliverRoute(RouteWorker& worker, const RouteJob& job) {
+    string idField = job.messageId.empty() ? "" : "|ID:" + job.messageId;
+    shared_ptr<Outbound> outbound = ownedOutbound(worker, job.targetCampus, job.lane, job.traceId);
+    if (outbound && queueRouted(outbound, job.lane, job.message, job.traceId)) {
+        settleMessage(job.dedup, job.dedupId);
+        replyToSource(worker, job, "ACK:Message delivered to " + job.targetCampus + idField, job.traceId);
+    } else if (forwardToHub(job)) {
+        //the sender is answered when the other hub reports back with FWD_ACK
+    } else {
+        forgetMessage(job.dedup, job.dedupId);
+        replyToSource(worker, job, "ERROR:Unable to deliver message to " + job.targetCampus + idField, 0);
+        printLog("Failed to route message to: " + job.targetCampus, "ERROR");
+    }
+}
+
+//on the source campus's worker: deliver here or pass the job to the target's worker
+void dispatchRoute(RouteWorker& worker, RouteJob& job) {
+    if (job.traceId) traceBuffer.record(job.traceId, "route_queue", laneNames[job.lane], job.queuedMicros, traceNowMicros());
+    RouteWorker& target = workerOf(job.targetCampus);
+    if (&target == &worker) {
+        deliverRoute(worker, job);
+    } else {
+        passToWorker(worker, target, WorkerItem{ROUTE_DELIVER, move(job)});
+    }
+}
+
+//deliveries and replies other workers passed here, bounded per inbox so one
+//busy worker cannot starve the rest
+void drainInbox(RouteWorker& worker) {
+    WorkerItem item;
+    for (auto& queue : worker.inbox) {
+        for (size_t handled = 0; queue && handled < queue->capacity() && queue->pop(item); handled++) {
+            if (item.kind == ROUTE_DELIVER) {
+                deliverRoute(worker, item.job);
+                continue;
+            }
+            shared_ptr<Outbound> outbound = ownedOutbound(worker, item.job.sourceCampus, LANE_URGENT, item.job.traceId);
+            if (outbound) queueOutbound(outbound, LANE_URGENT, item.job.message, nullptr, item.job.traceId);
+        }
+    }
+}
+
+//route worker: deficit round robin across its source campuses so one flooding
+//campus only ever gets its quantum per round; the urgent lane is served first
+//since dispatching into the outbound lanes never blocks. While another worker's
+//inbox is full it takes no new routes, only its own inbox and the backlog
+void runRouteWorker(RouteWorker* worker) {
+    if (worker->cpu >= 0 && !pinThread(worker->cpu)) {
+        printLog("Could not pin route worker " + to_string(worker->index) + " to CPU " + to_string(worker->cpu), "WARNING");
+    }
+    RouteLane* routeLanes = worker->routeLanes;
+    bool backlogged = false;
+    while (true) {
+        vector<RouteJob> batch;
+        {
+            unique_lock<mutex> lock(worker->routeMutex);
+            auto ready = [&] {
+                return inboxPending(*worker) || (!backlogged && (!routeLanes[LANE_URGENT].activeSources.empty() ||
+                                                                 !routeLanes[LANE_BULK].activeSources.empty()));
+            };
+            worker->sleeping = true;
+            atomic_thread_fence(memory_order_seq_cst);
+            if (backlogged) {
+                worker->wake.wait_for(lock, chrono::milliseconds(WORKER_BACKLOG_POLL_MS), ready);
+            } else {
+                worker->wake.wait(lock, ready);
+            }
+            worker->sleeping = false;
+            worker->routing = true;
+            bool urgent = !routeLanes[LANE_URGENT].activeSources.empty();
+            if (!backlogged && (urgent || !routeLanes[LANE_BULK].activeSources.empty())) {
+                RouteLane& routeLane = urgent ? routeLanes[LANE_URGENT] : routeLanes[LANE_BULK];
+                deque<string>& activeSources = routeLane.activeSources;
+                string source = activeSources.front();
+                activeSources.pop_front();
+                SourceQueue& queue = routeLane.queues[source];
+                queue.deficit += drrQuantum;
+                while (!queue.jobs.empty() && queue.jobs.front().message.length() <= queue.deficit) {
+                    queue.deficit -= queue.jobs.front().message.length();
+                    batch.push_back(move(queue.jobs.front()));
+                    queue.jobs.pop_front();
+                }
+                if (queue.jobs.empty()) {
+                    queue.deficit = 0;
+                    queue.scheduled = false;
+                } else {
+                    activeSources.push_back(source);
+                }
+            }
+        }
+        flushBacklog(*worker);
+        drainInbox(*worker);
+        for (auto& job : batch) {
+            dispatchRoute(*worker, job);
+        }
+        backlogged = flushBacklog(*worker);
+        {
+            lock_guard<mutex> lock(worker->routeMutex);
+            worker->routing = backlogged;
+        }
+    }
+}
+
+//create the workers and their inboxes (before a takeover imports campuses into them)
+void createRouteWorkers() {
+    //every worker has an inbox per other worker, so the slots per pair shrink as
+    //workers are added instead of preallocating N*(N-1) full size queues
+    size_t inboxSize = WORKER_INBOX_SIZE;
+    while (inboxSize > WORKER_INBOX_MIN && inboxSize * (workerCount - 1) > WORKER_INBOX_BUDGET) inboxSize /= 2;
+    for (size_t i = 0; i < workerCount; i++) {
+        unique_ptr<RouteWorker> worker = make_unique<RouteWorker>();
+        worker->index = static_cast<int>(i);
+        worker->cpu = workerCpus.empty() ? -1 : workerCpus[i % workerCpus.size()];
+        worker->inbox.resize(workerCount);
+        worker->backlog.resize(workerCount);
+        for (size_t from = 0; from < workerCount; from++) {
+            if (from != i) worker->inbox[from] = make_unique<SpscQueue<WorkerItem>>(inboxSize);
+        }
+        routeWorkers.push_back(move(worker));
+    }
+}
+
+string transferKey(const string& sourceCampus, const string& id) {
+    return sourceCampus + "/" + id;
+}
+
+//give the sender one credit back once a chunk has reached the target socket
+void returnTransferCredit(const string& key) {
+    lock_guard<mutex> lock(transferMutex);
+    auto it = transfers.find(key);
+    if (it == transfers.end()) return;
+    it->second.inFlight--;
+    queueOutbound(it->second.sourceOut, LANE_URGENT, "XFER_CREDIT:" + it->second.id + "|N:1");
+}
+
+//relay one XFER_* frame from a protocol 2 campus; false means a protocol
+//violation and the connection is dropped
+bool handleTransferFrame(const string& campusName, const shared_ptr<Outbound>& outbound,
+                         FrameReader& reader, const string& line) {
+    string command = line.substr(0, line.find(':'));
+    string id = protocolField(line, command);
+    if (id.empty()) return false;
+    string key = transferKey(campusName, id);
+
+    if (command == "XFER_OPEN") {
+        string targetCampus = protocolField(line, "TARGET");
+        long long retryMs = 0;
+        if (!admitRoute(campusName, targetCampus, retryMs)) {
+            queueOutbound(outbound, LANE_URGENT, "ERROR:RATE_LIMITED|TARGET:" + targetCampus +
+                          "|RETRY_MS:" + to_string(retryMs) + "|XFER:" + id);
+            return true;
+        }
+        shared_ptr<Outbound> targetOut;
+        {
+            lock_guard<mutex> lock(clientMutex);
+            auto it = connectedClients.find(targetCampus);
+            if (it != connectedClients.end() && it->second.isActive && it->second.outbound->framed) {
+                targetOut = it->second.outbound;
+            }
+        }
+        string error;
+        {
+            lock_guard<mutex> lock(transferMutex);
+            int open = 0;
+            for (const auto& pair : transfers) {
+                if (pair.second.sourceCampus == campusName) open++;
+            }
+            if (open >= MAX_TRANSFERS_PER_CAMPUS) {
+                error = "ERROR:Too many open transfers";
+            } else if (transfers.count(key)) {
+                error = "ERROR:Transfer " + id + " is already open";
+            } else if (!targetOut) {
+                error = "ERROR:Unable to open transfer to " + targetCampus;
+            } else {
+                string openFrame = "XFER_OPEN:" + id + "|FROM:" + campusName +
+                                   "|DEPT:" + protocolField(line, "DEPT") +
+                                   "|NAME:" + protocolField(line, "NAME") +
+                                   "|SIZE:" + protocolField(line, "SIZE") + "\n";
+                if (!queueTransferFrame(targetOut, openFrame, nullptr)) {
+                    error = "ERROR:Unable to open transfer to " + targetCampus;
+                } else {
+                    Transfer transfer;
+                    transfer.sourceCampus = campusName;
+                    transfer.targetCampus = targetCampus;
+                    transfer.id = id;
+                    transfer.sourceOut = outbound;
+                    transfer.targetOut = targetOut;
+                    transfers[key] = transfer;
+                    queueOutbound(outbound, LANE_URGENT, "XFER_CREDIT:" + id + "|N:" + to_string(TRANSFER_WINDOW));
+                }
+            }
+        }
+        if (!error.empty()) {
+            queueOutbound(outbound, LANE_URGENT, error + "|XFER:" + id);
+            printLog("Transfer " + key + " rejected: " + error.substr(6), "ERROR");
+        } else {
+            printLog(string(CYAN) + campusName + RESET + " => " + YELLOW + targetCampus + RESET +
+                     " file \"" + protocolField(line, "NAME") + "\" (" + protocolField(line, "SIZE") + " bytes)", "ROUTE");
+        }
+        return true;
+    }
+
+    if (command == "XFER_CHUNK") {
+        size_t length;
+        try {
+            length = stoul(protocolField(line, "LEN"));
+        } catch (const exception&) {
+            return false;
+        }
+        if (length > TRANSFER_CHUNK_SIZE) return false;
+        string data;
+        if (!reader.readBlock(length, data)) return false;
+
+        lock_guard<mutex> lock(transferMutex);
+        auto it = transfers.find(key);
+        if (it == transfers.end()) return true;   //late chunk of an aborted transfer
+        Transfer& transfer = it->second;
+        string error;
+        if (transfer.inFlight >= TRANSFER_WINDOW) {
+            error = "ERROR:Transfer " + id + " exceeded its credit window";
+        } else {
+            string frame = "XFER_CHUNK:" + id + "|FROM:" + campusName + "|SEQ:" + protocolField(line, "SEQ") +
+                           "|LEN:" + to_string(length) + "\n" + data;
+            if (queueTransferFrame(transfer.targetOut, move(frame), [key] { returnTransferCredit(key); })) {
+                transfer.inFlight++;
+                return true;
+            }
+            error = "ERROR:Transfer aborted, " + transfer.targetCampus + " disconnected";
+        }
+        queueTransferFrame(transfer.targetOut, "XFER_ABORT:" + id + "|FROM:" + campusName + "\n", nullptr);
+        queueOutbound(outbound, LANE_URGENT, error + "|XFER:" + id);
+        transfers.erase(it);
+        return true;
+    }
+
+    if (command == "XFER_END" || command == "XFER_ABORT") {
+        lock_guard<mutex> lock(transferMutex);
+        auto it = transfers.find(key);
+        if (it == transfers.end()) return true;
+        Transfer transfer = it->second;
+        transfers.erase(it);
+        if (command == "XFER_ABORT") {
+            queueTransferFrame(transfer.targetOut, "XFER_ABORT:" + id + "|FROM:" + campusName + "\n", nullptr);
+            printLog("Transfer " + key + " aborted by sender", "WARNING");
+            return true;
+        }
+        //acknowledge once the end marker (and so every chunk) reached the target
+        shared_ptr<Outbound> sourceOut = transfer.sourceOut;
+        string ack = "ACK:Transfer " + id + " delivered to " + transfer.targetCampus + "|XFER:" + id;
+        if (!queueTransferFrame(transfer.targetOut, "XFER_END:" + id + "|FROM:" + campusName + "\n",
+                                [sourceOut, ack] { queueOutbound(sourceOut, LANE_URGENT, ack); })) {
+            queueOutbound(outbound, LANE_URGENT, "ERROR:Transfer aborted, " + transfer.targetCampus +
+                          " disconnected|XFER:" + id);
+        }
+        return true;
+    }
+    return true;
+}
+
+//abort every transfer a disconnecting campus was sending or receiving
+void dropTransfersOf(const string& campusName) {
+    lock_guard<mutex> lock(transferMutex);
+    for (auto it = transfers.begin(); it != transfers.end();) {
+        const Transfer& transfer = it->second;
+        if (transfer.sourceCampus == campusName) {
+            queueTransferFrame(transfer.targetOut, "XFER_ABORT:" + transfer.id + "|FROM:" + campusName + "\n", nullptr);
+        } else if (transfer.targetCampus == campusName) {
+            queueOutbound(transfer.sourceOut, LANE_URGENT, "ERROR:Transfer aborted, " + campusName +
+                          " disconnected|XFER:" + transfer.id);
+        } else {
+            ++it;
+            continue;
+        }
+        it = transfers.erase(it);
+    }
+}
+
+//tell every linked hub that a local campus came or went
+void announceLocation(const string& campusName, bool up) {
+    lock_guard<mutex> lock(hubMutex);
+    for (auto& link : peerLinks) {
+        queueOutbound(link.second, LANE_URGENT, "LOC:" + campusName + "|HUB:" + to_string(hubId) + "|UP:" + (up ? "1" : "0"));
+    }
+}
+
+//deliver an announcement to this hub's campuses, returns how many got it
+int deliverBroadcast(const string& broadcastMsg) {
+    int sentCount = 0;
+    //lock the client list so no other thread can modify it
+    //while we're iterating over it
+    lock_guard<mutex> lock(clientMutex);
+    for (const auto& pair : connectedClients) {
+        //campuses without a heartbeat yet get it on their urgent TCP lane
+        if (pair.second.isActive && !pair.second.hasUdpAddr) {
+            if (queueOutbound(pair.second.outbound, LANE_URGENT, broadcastMsg)) {
+                sentCount++;
+            }
+            continue;
+        }
+        //only send to clients that are currently marked ACTIVE
+        //and have already sent us a heartbeat (so we know their IP/port)
+        if (pair.second.isActive && pair.second.hasUdpAddr) {
+            //send the broadcast message directly to this campus's
+            //last known UDP address (stored from its heartbeat)
+            sendto(
+                broadcastSocket,
+                broadcastMsg.c_str(),
+                static_cast<int>(broadcastMsg.length()),
+                0,
+                (sockaddr*)&pair.second.udpAddr,
+                sizeof(pair.second.udpAddr)
+            );
+            //track how many clients actually received the broadcast
+            sentCount++;
+        }
+    }
+    return sentCount;
+}
+
+//serve one established hub link until it drops
+void runPeerLink(SOCKET peerSocket, int peerId, FrameReader& reader) {
+    shared_ptr<Outbound> outbound = make_shared<Outbound>();
+    outbound->framed = true;
+    {
+        lock_guard<mutex> lock(hubMutex);
+        if (peerLinks.count(peerId)) {
+            closesocket(peerSocket);   //both sides dialed, keep the first link
+            return;
+        }
+        peerLinks[peerId] = outbound;
+    }
+    thread writerThread(outboundWriter, peerSocket, outbound);
+    writerThread.detach();
+
+    //snapshot of our campuses so the new peer can route to them
+    vector<string> localCampuses;
+    {
+        lock_guard<mutex> lock(clientMutex);
+        for (const auto& pair : connectedClients) {
+            if (pair.second.isActive) localCampuses.push_back(pair.first);
+        }
+    }
+    for (const auto& campus : localCampuses) {
+        queueOutbound(outbound, LANE_URGENT, "LOC:" + campus + "|HUB:" + to_string(hubId) + "|UP:1");
+    }
+    printLog("Linked with hub " + to_string(peerId), "CONNECT");
+
+    string line;
+    string payload;
+    while (reader.readLine(line)) {
+        if (line.rfind("LOC:", 0) == 0) {
+            string campus = protocolField(line, "LOC");
+            int hub = atoi(protocolField(line, "HUB").c_str());
+            bool up = protocolField(line, "UP") == "1";
+            //two hubs admitted the campus at once (or while their link was down): the
+            //lower hub id keeps it and the other one drops its session, whose client
+            //then reconnects and is told ALREADY_CONNECTED until it reaches the winner
+            if (up) {
+                lock_guard<mutex> lock(clientMutex);
+                auto local = connectedClients.find(campus);
+                if (local != connectedClients.end() && local->second.isActive) {
+                    if (hub > hubId) continue;   //ours wins, the other hub drops its session on our LOC
+                    printLog("Campus " + campus + " is also logged in to hub " + to_string(hub) +
+                             ", which wins, dropping the session here", "WARNING");
+                    shutdown(local->second.tcpSocket, SD_BOTH);
+                }
+            }
+            lock_guard<mutex> lock(hubMutex);
+            if (up) {
+                campusLocations[campus] = hub;
+            } else if (campusLocations.count(campus) && campusLocations[campus] == hub) {
+                campusLocations.erase(campus);
+            }
+        } else if (line.rfind("FWD:", 0) == 0) {
+            size_t length = strtoul(protocolField(line, "LEN").c_str(), nullptr, 10);
+            if (length > MAX_LINE_LENGTH || !reader.readBlock(length, payload)) break;
+            int lane = atoi(protocolField(line, "LANE").c_str()) == LANE_URGENT ? LANE_URGENT : LANE_BULK;
+            string targetCampus = protocolField(line, "TARGET");
+            bool delivered = sendToClient(targetCampus, payload, lane, parseTraceId(protocolField(line, "TRACE")), true);
+            queueOutbound(outbound, LANE_URGENT, "FWD_ACK:" + protocolField(line, "FWD") + "|OK:" + (delivered ? "1" : "0"));
+            printLog(string(CYAN) + protocolField(line, "SRC") + RESET + " -> " + YELLOW + targetCampus + RESET +
+                     " (via hub " + to_string(peerId) + ")", "ROUTE");
+        } else if (line.rfind("FWD_ACK:", 0) == 0) {
+            PendingForward forward;
+            {
+                lock_guard<mutex> lock(hubMutex);
+                auto it = pendingForwards.find(strtoull(protocolField(line, "FWD_ACK").c_str(), nullptr, 10));
+                if (it == pendingForwards.end()) continue;
+                forward = it->second;
+                pendingForwards.erase(it);
+            }
+            string idField = forward.messageId.empty() ? "" : "|ID:" + forward.messageId;
+            if (protocolField(line, "OK") == "1") {
+                settleMessage(forward.dedup, forward.dedupId);
+                sendToClient(forward.sourceCampus, "ACK:Message delivered to " + forward.targetCampus + idField, LANE_URGENT);
+            } else {
+                forgetMessage(forward.dedup, forward.dedupId);
+                sendToClient(forward.sourceCampus, "ERROR:Unable to deliver message to " + forward.targetCampus + idField, LANE_URGENT);
+            }
+        } else if (line.rfind("BCAST:", 0) == 0) {
+            //delivered locally only and never passed on, so with a full mesh
+            //every hub sees each broadcast exactly once
+            size_t length = strtoul(protocolField(line, "LEN").c_str(), nullptr, 10);
+            if (length > MAX_LINE_LENGTH || !reader.readBlock(length, payload)) break;
+            int sentCount = deliverBroadcast("BROADCAST:" + payload);
+            printLog("Broadcast from hub " + protocolField(line, "BCAST") + " sent to " + to_string(sentCount) +
+                     " campus(es)", "BROADCAST");
+        }
+    }
+
+    //link down: forget the peer's campuses and fail forwards it never answered
+    vector<PendingForward> failed;
+    {
+        lock_guard<mutex> lock(hubMutex);
+        peerLinks.erase(peerId);
+        for (auto it = campusLocations.begin(); it != campusLocations.end();) {
+            it = it->second == peerId ? campusLocations.erase(it) : next(it);
+        }
+        for (auto it = pendingForwards.begin(); it != pendingForwards.end();) {
+            if (it->second.hub == peerId) {
+                failed.push_back(it->second);
+                it = pendingForwards.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (const auto& forward : failed) {
+        forgetMessage(forward.dedup, forward.dedupId);
+        sendToClient(forward.sourceCampus, "ERROR:Unable to deliver message to " + forward.targetCampus +
+                     (forward.messageId.empty() ? "" : "|ID:" + forward.messageId), LANE_URGENT);
+    }
+    {
+        lock_guard<mutex> lock(outbound->lock);
+        outbound->closed = true;
+    }
+    outbound->ready.notify_one();
+    printLog("Lost link to hub " + to_string(peerId), "DISCONNECT");
+}
+
+//keep a link to a lower numbered hub, redialing whenever it drops
+void peerDialer(HubPeer peer) {
+    while (true) {
+        SOCKET peerSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in peerAddr;
+        peerAddr.sin_family = AF_INET;
+        peerAddr.sin_addr.s_addr = inet_addr(peer.host.c_str());
+        peerAddr.sin_port = htons(peer.port);
+        if (peerSocket != INVALID_SOCKET &&
+            connect(peerSocket, (sockaddr*)&peerAddr, sizeof(peerAddr)) != SOCKET_ERROR &&
+            sendAll(peerSocket, "HUB:" + to_string(hubId) + "\n")) {
+            FrameReader reader(peerSocket);
+            string hello;
+            if (reader.readLine(hello) && hello == "HUB:" + to_string(peer.id)) {
+                runPeerLink(peerSocket, peer.id, reader);
+            } else {
+                closesocket(peerSocket);
+            }
+        } else if (peerSocket != INVALID_SOCKET) {
+            closesocket(peerSocket);
+        }
+        this_thread::sleep_for(chrono::milliseconds(PEER_RETRY_MS));
+    }
+}
+
+//link dialed by a higher numbered hub: "HUB:<id>" handshake, then serve it
+void handlePeerConnection(SOCKET peerSocket) {
+    FrameReader reader(peerSocket);
+    string hello;
+    if (!reader.readLine(hello) || hello.rfind("HUB:", 0) != 0) {
+        closesocket(peerSocket);
+        return;
+    }
+    int peerId = atoi(hello.c_str() + 4);
+    bool known = false;
+    for (const auto& peer : hubPeers) {
+        if (peer.id == peerId) known = true;
+    }
+    if (!known || !sendAll(peerSocket, "HUB:" + to_string(hubId) + "\n")) {
+        printLog("Rejected link from unknown hub " + to_string(peerId), "WARNING");
+        closesocket(peerSocket);
+        return;
+    }
+    runPeerLink(peerSocket, peerId, reader);
+}
+
+//wait briefly for a pending connection or datagram; never true while handing off
+//so the next process finds it still queued on the shared socket
+bool socketReady(SOCKET sock) {
+    if (handoffActive) {
+        this_thread::sleep_for(chrono::milliseconds(HANDOFF_POLL_MS));
+        return false;
+    }
+    return waitReadable(sock, HANDOFF_POLL_MS) > 0;
+}
+
+void peerAcceptor(SOCKET listenSocket) {
+    while (true) {
+        if (!socketReady(listenSocket)) continue;
+        SOCKET peerSocket = accept(listenSocket, nullptr, nullptr);
+        if (peerSocket != INVALID_SOCKET) {
+            thread peerThread(handlePeerConnection, peerSocket);
+            peerThread.detach();
+        }
+    }
+}
+
+//a handler may only start serving while no handoff is collecting connections
+bool beginServing() {
+    lock_guard<mutex> lock(handoffMutex);
+    if (handoffActive) return false;
+    servingHandlers++;
+    return true;
+}
+
+void endServing() {
+    {
+        lock_guard<mutex> lock(handoffMutex);
+        servingHandlers--;
     }
-    campusName = authMsg.substr(campusPos + 7, passPos - campusPos - 7);
-    string password = authMsg.substr(passPos + 6);
-    auto it = validCredentials.find(campusName);
-    if (it != validCredentials.end() && it->second == password) {
+    handoffCv.notify_all();
+}
+
+//hand a connection to the running handoff; false if the handoff was abandoned meanwhile
+bool parkConnection(const string& campusName, SOCKET clientSocket, FrameReader& reader,
+                    const shared_ptr<Outbound>& outbound) {
+    {
+        lock_guard<mutex> lock(handoffMutex);
+        if (!handoffActive) return false;
+        parkedConnections.push_back(ParkedConnection{campusName, clientSocket, outbound, reader.pending()});
+        servingHandlers--;
+    }
+    handoffCv.notify_all();
+    return true;
+}
+
+//a warning a campus can trigger at will is logged once per RATE_LOG_INTERVAL_MS,
+//with a count of the ones held back, so it cannot hold handlers up on the console
+struct LogThrottle {
+    long long lastMicros = 0;
+    unsigned long long suppressed = 0;
+
+    //true when this one may be logged, suffix then reports what was held back
+    bool allow(long long nowMicros, string& suffix) {
+        if (nowMicros - lastMicros < RATE_LOG_INTERVAL_MS * 1000LL) {
+            suppressed++;
+            return false;
+        }
+        suffix = suppressed ? " (" + to_string(suppressed) + " more suppressed)" : "";
+        lastMicros = nowMicros;
+        suppressed = 0;
         return true;
     }
-    return false;
+};
+
+//serve phase of a campus connection: route its messages until it disconnects
+//or is parked for a handoff
+void serveCampusClient(const string& campusName, SOCKET clientSocket, FrameReader& reader,
+                       shared_ptr<Outbound> outbound) {
+    bool framed = outbound->framed;
+    shared_ptr<DedupWindow> dedup = dedupWindowOf(campusName);
+    //the owning worker delivers to this campus from now on
+    RouteWorker& worker = *routeWorkers[outbound->worker];
+    pinToWorker(outbound->worker);
+    {
+        lock_guard<mutex> lock(worker.campusMutex);
+        worker.campuses[campusName] = outbound;
+    }
+    LogThrottle rateLog;        //rate limit warnings of this campus
+    LogThrottle duplicateLog;   //retries answered from the dedup window (a reconnect resends up to 1000)
+    string suppressed;
+    //main message handling loop
+    string message;
+    while (true) {
+        //park between messages while the connection is handed to a new process
+        if (handoffActive && parkConnection(campusName, clientSocket, reader, outbound)) {
+            return;
+        }
+        if (!reader.waitReadable(HANDOFF_POLL_MS)) continue;
+        bool received = framed ? reader.readLine(message) : reader.readAvailable(message);
+        long long receivedMicros = traceNowMicros();
+        if (!received) {
+            printLog(string("Campus ") + CYAN + campusName + RESET + " disconnected", "DISCONNECT");
+            break;
+        }
+        //what the campus sends proves liveness as well as a heartbeat, busy senders skip heartbeats
+        outbound->lastSeenMicros.store(receivedMicros, memory_order_relaxed);
+        //a legacy recv is relayed verbatim, and a line break inside it would split the
+        //message (or forge a transfer frame) at a protocol 2 receiver
+        if (!framed) {
+            while (!message.empty() && (message.back() == '\n' || message.back() == '\r')) message.pop_back();
+            if (message.find('\n') != string::npos) {
+                string messageId = protocolField(message.substr(0, message.find("|MSG:")), "ID");
+                queueOutbound(outbound, LANE_URGENT, "ERROR:Line breaks are not allowed in messages" +
+                              (messageId.empty() ? "" : "|ID:" + messageId));
+                continue;
+            }
+        }
+        if (framed && message.rfind("XFER_", 0) == 0) {
+            if (!handleTransferFrame(campusName, outbound, reader, message)) {
+                printLog("Malformed transfer frame from " + campusName + ", dropping connection", "ERROR");
+                break;
+            }
+            continue;
+        }
+        //one pass over the header, the payload after MSG: is never scanned
+        RouteHeader header;
+        if (parseRouteHeader(message, header)) {
+            string targetCampus(header.target);
+            string targetDept(header.dept);
+            string sourceCampus(header.from);
+            string messageId(header.id);
+            int lane = header.priority == "URGENT" ? LANE_URGENT : LANE_BULK;
+            RouteJob job{campusName, targetCampus, message, lane, messageId};
+            job.traceId = parseTraceId(string(header.trace));
+            if (job.traceId == 0 && traceSample(traceRate)) job.traceId = newTraceId();
+            job.queuedMicros = traceNowMicros();
+            if (job.traceId) {
+                traceBuffer.record(job.traceId, "recv_parse", laneNames[lane], receivedMicros, job.queuedMicros);
+            }
+            //a retry of a message we already delivered is acknowledged, not sent twice,
+            //one still in flight is answered by the original's ACK or ERROR
+            unsigned long long numericId = 0;
+            bool deduplicated = parseMessageId(messageId, numericId);
+            if (deduplicated) {
+                lock_guard<mutex> lock(dedup->lock);
+                if (dedup->pending.count(numericId)) {
+                    if (duplicateLog.allow(receivedMicros, suppressed)) {
+                        printLog("Duplicate message " + messageId + " from " + campusName + " still in flight" + suppressed, "WARNING");
+                    }
+                    continue;
+                }
+                if (dedup->contains(numericId)) {
+                    queueOutbound(outbound, LANE_URGENT, "ACK:Message delivered to " + targetCampus + "|ID:" + messageId);
+                    if (duplicateLog.allow(receivedMicros, suppressed)) {
+                        printLog("Duplicate message " + messageId + " from " + campusName + " acknowledged" + suppressed, "WARNING");
+                    }
+                    continue;
+                }
+            }
+            //throttle before queueing so a flooding campus is told to back off
+            long long retryMs = 0;
+            bool admitted = admitRoute(campusName, targetCampus, retryMs);
+            if (admitted && deduplicated) {
+                //marked before the router can fail it and forget the id again
+                lock_guard<mutex> lock(dedup->lock);
+                dedup->insert(numericId);
+                dedup->pending.insert(numericId);
+                job.dedup = dedup;
+                job.dedupId = numericId;
+            }
+            if (admitted && !enqueueRoute(move(job), retryMs)) {
+                admitted = false;
+                if (deduplicated) {
+                    lock_guard<mutex> lock(dedup->lock);
+                    dedup->erase(numericId);
+                }
+            }
+            if (!admitted) {
+                string error = "ERROR:RATE_LIMITED|TARGET:" + targetCampus + "|RETRY_MS:" + to_string(retryMs) +
+                               (messageId.empty() ? "" : "|ID:" + messageId);
+                queueOutbound(outbound, LANE_URGENT, error);
+                if (rateLog.allow(receivedMicros, suppressed)) {
+                    printLog("Rate limited " + campusName + " -> " + targetCampus + suppressed, "WARNING");
+                }
+                continue;
+            }
+            printLog(string(CYAN) + sourceCampus + RESET + " -> " + YELLOW + targetCampus + RESET + 
+                     " [" + GREEN + targetDept + RESET + "]" +
+                     (lane == LANE_URGENT ? string(" ") + BRIGHT_RED + "URGENT" + RESET : string()), "ROUTE");
+        } else {
+            //answer it so the sender retires the message instead of resending it forever,
+            //the id is looked up before MSG: so payload text cannot supply it
+            string messageId = protocolField(message.substr(0, message.find("|MSG:")), "ID");
+            queueOutbound(outbound, LANE_URGENT, "ERROR:MALFORMED_HEADER" + (messageId.empty() ? "" : "|ID:" + messageId));
+        }
+    }
+    
+    //cleanup, the writer thread closes the socket once it sees the lanes closed
+    {
+        lock_guard<mutex> lock(clientMutex);
+        connectedClients[campusName].isActive = false;
+    }
+    {
+        lock_guard<mutex> lock(worker.campusMutex);
+        auto it = worker.campuses.find(campusName);
+        if (it != worker.campuses.end() && it->second == outbound) worker.campuses.erase(it);
+    }
+    dropTransfersOf(campusName);
+    announceLocation(campusName, false);
+    {
+        lock_guard<mutex> lock(outbound->lock);
+        outbound->closed = true;
+    }
+    outbound->ready.notify_one();
+    endServing();
 }
-//send message to specific campus
-bool sendToClient(const string& targetCampus, const string& message) {
-    lock_guard<mutex> lock(clientMutex);//synchornization     
-    auto it = connectedClients.find(targetCampus);
-    if (it != connectedClients.end() && it->second.isActive) {
-        int result = send(it->second.tcpSocket, message.c_str(), static_cast<int>(message.length()), 0);
-        return result != SOCKET_ERROR;
+
+
+//serve a connection that was parked (or taken over) with its unread bytes
+void resumeCampusClient(string campusName, SOCKET clientSocket, string pending, shared_ptr<Outbound> outbound) {
+    {
+        lock_guard<mutex> lock(handoffMutex);
+        servingHandlers++;
     }
-    return false;
+    FrameReader reader(clientSocket, move(pending));
+    serveCampusClient(campusName, clientSocket, reader, outbound);
 }
+
 //handle individual campus client TCP connection
 void handleCampusClient(SOCKET clientSocket, sockaddr_in clientAddr) {
-    char buffer[BUFFER_SIZE];
+    FrameReader reader(clientSocket);
     string campusName;     
     //authentication phase
-    memset(buffer, 0, BUFFER_SIZE);
-    int bytesReceived = recv(clientSocket, buffer, BUFFER_SIZE - 1, 0);
-    if (bytesReceived <= 0) {
+    string authMsg;
+    if (!reader.readAvailable(authMsg)) {
         printLog("Client disconnected before authentication", "WARNING");
         closesocket(clientSocket);
         return;
     }
-    string authMsg(buffer);
-    if (!authenticateClient(authMsg, campusName)) {
-        string response = "AUTH_FAILED";
+    while (!authMsg.empty() && (authMsg.back() == '\n' || authMsg.back() == '\r' || authMsg.back() == '\0')) {
+        authMsg.pop_back();
+    }
+    int protocol = 1;
+    bool authenticated = authenticateClient(authMsg, campusName, protocol);
+    bool framed = protocol >= PROTOCOL_VERSION;
+    string terminator = framed ? "\n" : "";
+    if (!authenticated) {
+        string response = "AUTH_FAILED" + terminator;
         send(clientSocket, response.c_str(), static_cast<int>(response.length()), 0);
         printLog("Authentication failed for: " + authMsg, "ERROR");
         closesocket(clientSocket);
         return;
     }
-    //check and avoid already connected campus
+    //check and avoid already connected campus (here or on another hub)
+    bool remote;
+    {
+        lock_guard<mutex> lock(hubMutex);
+        remote = campusLocations.count(campusName) > 0;
+    }
     {
         lock_guard<mutex> lock(clientMutex);
-        if (connectedClients.find(campusName) != connectedClients.end() && 
-            connectedClients[campusName].isActive) {
-            string response = "ALREADY_CONNECTED";
+        if (remote || (connectedClients.find(campusName) != connectedClients.end() && 
+            connectedClients[campusName].isActive)) {
+            string response = "ALREADY_CONNECTED" + terminator;
             send(clientSocket, response.c_str(), static_cast<int>(response.length()), 0);
             printLog("Campus " + campusName + " already connected", "WARNING");
             closesocket(clientSocket);
             return;
         }
     }
-    string response = "AUTH_SUCCESS";
+    //a handoff is collecting connections, the campus reconnects to the new process
+    if (!beginServing()) {
+        closesocket(clientSocket);
+        return;
+    }
+    string response = "AUTH_SUCCESS" + terminator;
     send(clientSocket, response.c_str(), static_cast<int>(response.length()), 0);     
     //register client
+    shared_ptr<Outbound> outbound = make_shared<Outbound>();
+    outbound->framed = framed;
+    outbound->worker = static_cast<int>(workerIndexOf(campusName));
+    outbound->lastSeenMicros = traceNowMicros();
     {
         lock_guard<mutex> lock(clientMutex);
         CampusClient client;
@@ -228,96 +1922,70 @@ void handleCampusClient(SOCKET clientSocket, sockaddr_in clientAddr) {
         client.campusName = campusName;
         client.lastHeartbeat = getCurrentTime();
         client.isActive = true;
+        client.outbound = outbound;
         connectedClients[campusName] = client;
-    }     
-    printLog(string("Campus ") + CYAN + campusName + RESET + " authenticated successfully", "CONNECT");
-    
-    //main message handling loop
-    while (true) {
-        memset(buffer, 0, BUFFER_SIZE);
-        bytesReceived = recv(clientSocket, buffer, BUFFER_SIZE - 1, 0);
-        
-        if (bytesReceived <= 0) {
-            printLog(string("Campus ") + CYAN + campusName + RESET + " disconnected", "DISCONNECT");
-            break;
-        }         
-        string message(buffer, bytesReceived);
-        size_t targetPos = message.find("TARGET:");
-        size_t deptPos = message.find("|DEPT:");
-        size_t fromPos = message.find("|FROM:");
-        size_t msgPos = message.find("|MSG:");
-        
-        if (targetPos != string::npos && deptPos != string::npos && 
-            fromPos != string::npos && msgPos != string::npos) {
-            
-            string targetCampus = message.substr(targetPos + 7, deptPos - targetPos - 7);
-            string targetDept = message.substr(deptPos + 6, fromPos - deptPos - 6);
-            string sourceCampus = message.substr(fromPos + 6, msgPos - fromPos - 6);
-            string msg = message.substr(msgPos + 5);   
-            printLog(string(CYAN) + sourceCampus + RESET + " -> " + YELLOW + targetCampus + RESET + 
-                     " [" + GREEN + targetDept + RESET + "]", "ROUTE");         
-            //forward message to target campus
-            if (sendToClient(targetCampus, message)) {
-                string ack = "ACK:Message delivered to " + targetCampus;
-                send(clientSocket, ack.c_str(), static_cast<int>(ack.length()), 0);
-            } else {
-                string error = "ERROR:Unable to deliver message to " + targetCampus;
-                send(clientSocket, error.c_str(), static_cast<int>(error.length()), 0);
-                printLog("Failed to route message to: " + targetCampus, "ERROR");
-            }
-        }
-    }
-    
-    //cleanup
-    {
-        lock_guard<mutex> lock(clientMutex);
-        connectedClients[campusName].isActive = false;
-        closesocket(clientSocket);
     }
+    thread writerThread(outboundWriter, clientSocket, outbound);
+    writerThread.detach();
+    announceLocation(campusName, true);
+    printLog(string("Campus ") + CYAN + campusName + RESET + " authenticated successfully", "CONNECT");
+    serveCampusClient(campusName, clientSocket, reader, outbound);
 }
 
 void handleUDPHeartbeat() {
-    SOCKET udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    SOCKET udpSocket = heartbeatSocket;
+    //a taken over server keeps the old process's bound socket
     if (udpSocket == INVALID_SOCKET) {
-        printLog("Failed to create UDP socket", "ERROR");
-        return;
-    }   
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;           //IPv4 addressing
-    serverAddr.sin_addr.s_addr = INADDR_ANY;//accept packets on any local network interface
-    serverAddr.sin_port = htons(UDP_PORT);  //convert port to network byte order and set it
+        udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (udpSocket == INVALID_SOCKET) {
+            printLog("Failed to create UDP socket", "ERROR");
+            return;
+        }   
+        sockaddr_in serverAddr;
+        serverAddr.sin_family = AF_INET;           //IPv4 addressing
+        serverAddr.sin_addr.s_addr = INADDR_ANY;//accept packets on any local network interface
+        serverAddr.sin_port = htons(udpPort);  //convert port to network byte order and set it
       
-    if (bind(udpSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        printLog("Failed to bind UDP socket", "ERROR"); //port already in use,binding failed
-        closesocket(udpSocket);
-        return;
-    }     
-    printLog("UDP heartbeat listener started on port " + to_string(UDP_PORT), "SUCCESS");     
+        if (bind(udpSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+            printLog("Failed to bind UDP socket", "ERROR"); //port already in use,binding failed
+            closesocket(udpSocket);
+            return;
+        }     
+        heartbeatSocket = udpSocket;
+    }
+    printLog("UDP heartbeat listener started on port " + to_string(udpPort), "SUCCESS");     
     char buffer[BUFFER_SIZE];
     sockaddr_in clientAddr;
     socklen_t clientAddrLen = sizeof(clientAddr);//to store sender's ip and port number     
     while (true) {
+        if (!socketReady(udpSocket)) continue;
         memset(buffer, 0, BUFFER_SIZE);
         int bytesReceived = recvfrom(udpSocket, buffer, BUFFER_SIZE - 1, 0, 
                                      (sockaddr*)&clientAddr, &clientAddrLen);         
         if (bytesReceived > 0) {
             string message(buffer);
-            if (message.find("HEARTBEAT:") == 0) {
-                size_t secondColon = message.find(":", 10);
+            //HEARTBEAT:campus:port marks the campus alive, UDP_ADDR:campus:port only
+            //refreshes the broadcast address (sent rarely by clients busy on TCP)
+            bool heartbeat = message.find("HEARTBEAT:") == 0;
+            if (heartbeat || message.find("UDP_ADDR:") == 0) {
+                size_t nameStart = message.find(':') + 1;
+                size_t secondColon = message.find(":", nameStart);
                 if (secondColon == string::npos) continue;
 
-                string campusName = message.substr(10, secondColon - 10); //Extract campus name
-                int udpPort = stoi(message.substr(secondColon + 1));
+                string campusName = message.substr(nameStart, secondColon - nameStart); //Extract campus name
+                int udpPort = atoi(message.c_str() + secondColon + 1);
 
                 {
                     lock_guard<mutex> lock(clientMutex); //thread-safe access to connectedClients map
                     auto it = connectedClients.find(campusName);
 
                     if (it != connectedClients.end()) {
-                        it->second.lastHeartbeat = getCurrentTime();   //update last heartbeat time
                         it->second.udpAddr = clientAddr;               //update stored UDP address
                         it->second.udpAddr.sin_port = htons(udpPort);  //set correct sender port
                         it->second.hasUdpAddr = true;                  //mark UDP info as valid
+                        if (!heartbeat) continue;
+                        it->second.lastHeartbeat = getCurrentTime();   //update last heartbeat time
+                        if (it->second.outbound) it->second.outbound->lastSeenMicros = traceNowMicros();
 
                         printLog(string(CYAN) + campusName + RESET + " @ " + 
                                  string(inet_ntoa(clientAddr.sin_addr)) + ":" + 
@@ -330,8 +1998,399 @@ void handleUDPHeartbeat() {
     closesocket(udpSocket);
 }
 
+#ifndef _WIN32
+//handoff records over the Unix socket: a 4 byte length sent together with the
+//descriptors (SCM_RIGHTS), then the text payload
+bool sendHandoffRecord(SOCKET sock, const string& payload, const vector<int>& fds) {
+    uint32_t length = htonl(static_cast<uint32_t>(payload.length()));
+    iovec iov;
+    iov.iov_base = &length;
+    iov.iov_len = sizeof(length);
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    if (!fds.empty()) {
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+    if (sendmsg(sock, &msg, 0) != sizeof(length)) return false;
+    return sendAll(sock, payload);
+}
+
+bool recvExact(SOCKET sock, char* data, size_t length) {
+    while (length > 0) {
+        int received = recv(sock, data, static_cast<int>(length), 0);
+        if (received <= 0) return false;
+        data += received;
+        length -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+bool recvHandoffRecord(SOCKET sock, string& payload, vector<int>& fds) {
+    uint32_t length;
+    iovec iov;
+    iov.iov_base = &length;
+    iov.iov_len = sizeof(length);
+    char control[CMSG_SPACE(sizeof(int) * 4)];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t received = recvmsg(sock, &msg, 0);
+    if (received <= 0) return false;
+    fds.clear();
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            fds.resize(count);
+            memcpy(fds.data(), CMSG_DATA(cmsg), sizeof(int) * count);
+        }
+    }
+    if (received < static_cast<ssize_t>(sizeof(length)) &&
+        !recvExact(sock, reinterpret_cast<char*>(&length) + received, sizeof(length) - received)) {
+        return false;
+    }
+    payload.assign(ntohl(length), '\0');
+    return payload.empty() || recvExact(sock, &payload[0], payload.length());
+}
+
+//abort every relayed transfer, chunks cannot follow their connection to the new process
+void abortAllTransfers() {
+    lock_guard<mutex> lock(transferMutex);
+    for (const auto& pair : transfers) {
+        const Transfer& transfer = pair.second;
+        queueTransferFrame(transfer.targetOut, "XFER_ABORT:" + transfer.id + "|FROM:" + transfer.sourceCampus + "\n", nullptr);
+        queueOutbound(transfer.sourceOut, LANE_URGENT, "ERROR:Transfer aborted, server restarting|XFER:" + transfer.id);
+    }
+    transfers.clear();
+}
+
+//no route queued, in an inbox or backlog, or being handled by any worker
+bool routesDrained() {
+    for (const auto& worker : routeWorkers) {
+        lock_guard<mutex> lock(worker->routeMutex);
+        if (worker->routing || !worker->routeLanes[LANE_URGENT].activeSources.empty() ||
+            !worker->routeLanes[LANE_BULK].activeSources.empty() || inboxPending(*worker)) return false;
+    }
+    return true;
+}
+
+//nothing left to route or to write, and no forward waiting for its hub
+bool handoffDrained() {
+    if (!routesDrained()) return false;
+    {
+        lock_guard<mutex> lock(hubMutex);
+        if (!pendingForwards.empty()) return false;
+    }
+    lock_guard<mutex> lock(handoffMutex);
+    for (const auto& parked : parkedConnections) {
+        lock_guard<mutex> outLock(parked.outbound->lock);
+        if (!parked.outbound->lanes[LANE_URGENT].empty() || !parked.outbound->lanes[LANE_BULK].empty()) return false;
+    }
+    return true;
+}
+
+//handoff failed: serve the parked connections again in this process
+void resumeParkedConnections() {
+    lock_guard<mutex> lock(handoffMutex);
+    handoffActive = false;
+    for (auto& parked : parkedConnections) {
+        //a writer that was never stopped, or is still stuck in a send, just carries on
+        bool writerRunning;
+        {
+            lock_guard<mutex> outLock(parked.outbound->lock);
+            writerRunning = !parked.outbound->writerDone;
+            parked.outbound->closed = false;
+            parked.outbound->handedOff = false;
+            parked.outbound->writerDone = false;
+        }
+        if (!writerRunning) {
+            thread writerThread(outboundWriter, parked.socket, parked.outbound);
+            writerThread.detach();
+        }
+        thread clientThread(resumeCampusClient, parked.campusName, parked.socket, move(parked.pending), parked.outbound);
+        clientThread.detach();
+    }
+    parkedConnections.clear();
+}
+
+//pass every socket and the campus table to the process on the other end of successor
+bool handOff(SOCKET successor) {
+    printLog("New server process connected, handing off...", "INFO");
+    {
+        lock_guard<mutex> lock(handoffMutex);
+        handoffActive = true;
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(HANDOFF_DRAIN_MS);
+    {
+        unique_lock<mutex> lock(handoffMutex);
+        if (!handoffCv.wait_until(lock, deadline, [] { return servingHandlers == 0; })) {
+            lock.unlock();
+            printLog("Campus handlers did not park in time, handoff abandoned", "ERROR");
+            resumeParkedConnections();
+            return false;
+        }
+    }
+    abortAllTransfers();
+    while (!handoffDrained() && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    //routes are not in the snapshot and their senders keep the connection, so they
+    //would never resend them: hand off only once every route has been answered
+    if (!routesDrained()) {
+        printLog("Route queues did not drain in time, handoff abandoned", "ERROR");
+        resumeParkedConnections();
+        return false;
+    }
+    //forwards still unanswered: have their senders retry against the new process
+    vector<PendingForward> unanswered;
+    {
+        lock_guard<mutex> lock(hubMutex);
+        for (const auto& pair : pendingForwards) unanswered.push_back(pair.second);
+    }
+    for (const auto& forward : unanswered) {
+        if (forward.messageId.empty()) continue;
+        forgetMessage(forward.dedup, forward.dedupId);
+        sendToClient(forward.sourceCampus, "ERROR:RATE_LIMITED|TARGET:" + forward.targetCampus +
+                     "|RETRY_MS:" + to_string(PEER_RETRY_MS) + "|ID:" + forward.messageId, LANE_URGENT);
+    }
+
+    //stop the writers, whatever they did not send travels in the snapshot. A writer
+    //blocked on a campus that stopped reading cannot stop, so we give up after a while
+    vector<ParkedConnection> parked;
+    {
+        lock_guard<mutex> lock(handoffMutex);
+        parked = parkedConnections;
+    }
+    for (auto& connection : parked) {
+        lock_guard<mutex> lock(connection.outbound->lock);
+        connection.outbound->closed = true;
+        connection.outbound->handedOff = true;
+        connection.outbound->ready.notify_all();
+    }
+    deadline = chrono::steady_clock::now() + chrono::milliseconds(HANDOFF_DRAIN_MS);
+    for (auto& connection : parked) {
+        unique_lock<mutex> lock(connection.outbound->lock);
+        if (!connection.outbound->ready.wait_until(lock, deadline, [&] { return connection.outbound->writerDone; })) {
+            lock.unlock();
+            printLog("Writer to " + connection.campusName + " is stuck sending, handoff abandoned", "ERROR");
+            resumeParkedConnections();
+            return false;
+        }
+    }
+
+    //snapshot: one record for the listening sockets, one per known campus
+    vector<int> listeners = {tcpListenSocket, heartbeatSocket};
+    if (peerListenSocket != INVALID_SOCKET) listeners.push_back(peerListenSocket);
+    bool sent = sendHandoffRecord(successor, "HANDOFF:" + to_string(PROTOCOL_VERSION) +
+                                  "|PEER:" + (peerListenSocket != INVALID_SOCKET ? "1" : "0"), listeners);
+    {
+        lock_guard<mutex> lock(clientMutex);
+        for (const auto& pair : connectedClients) {
+            const CampusClient& client = pair.second;
+            const ParkedConnection* connection = nullptr;
+            for (const auto& candidate : parked) {
+                if (candidate.campusName == pair.first) connection = &candidate;
+            }
+            string record = "CLIENT:" + pair.first + "|ACTIVE:" + (connection ? "1" : "0") +
+                            "|HB:" + lastSeenOf(client);
+            if (client.hasUdpAddr) {
+                record += string("|UDP:") + inet_ntoa(client.udpAddr.sin_addr) + "/" + to_string(ntohs(client.udpAddr.sin_port));
+            }
+            vector<int> fds;
+            if (connection) {
+                fds.push_back(connection->socket);
+                record += string("|FRAMED:") + (connection->outbound->framed ? "1" : "0") +
+                          "|PENDING:" + to_string(connection->pending.length()) + "\n" + connection->pending;
+                for (int lane = 0; lane < LANE_COUNT; lane++) {
+                    for (const auto& item : connection->outbound->lanes[lane]) {
+                        record += "ITEM:" + to_string(lane) + "|LEN:" + to_string(item.data.length()) + "\n" + item.data;
+                    }
+                }
+            } else {
+                record += "\n";
+            }
+            if (sent) sent = sendHandoffRecord(successor, record, fds);
+        }
+    }
+    //dedup windows, so retries after the upgrade are still recognised
+    {
+        lock_guard<mutex> lock(dedupMutex);
+        for (const auto& pair : dedupWindows) {
+            lock_guard<mutex> windowLock(pair.second->lock);
+            const DedupWindow& window = *pair.second;
+            if (!window.started) continue;
+            //ids never confirmed stay out, the new process routes their retry again
+            DedupWindow delivered;
+            delivered.started = true;
+            delivered.highest = window.highest;
+            memcpy(delivered.bits, window.bits, sizeof(window.bits));
+            for (unsigned long long id : window.pending) {
+                if (window.inWindow(id)) delivered.setBit(id, false);
+            }
+            string older;
+            for (unsigned long long id : window.olderOrder) {
+                if (window.older.count(id) && !window.pending.count(id)) older += (older.empty() ? "" : ",") + to_string(id);
+            }
+            string record = "DEDUP:" + pair.first + "|HIGH:" + to_string(window.highest) +
+                            "|BITS:" + toHex(reinterpret_cast<const unsigned char*>(delivered.bits), sizeof(delivered.bits)) +
+                            "|OLDER:" + older;
+            if (sent) sent = sendHandoffRecord(successor, record, {});
+        }
+    }
+    char reply[3];
+    if (sent) sent = sendHandoffRecord(successor, "END", {}) && recvExact(successor, reply, 3) &&
+                     string(reply, 3) == "OK\n";
+    if (!sent) {
+        printLog("Handoff to the new process failed, resuming service", "ERROR");
+        resumeParkedConnections();
+        return false;
+    }
+    printLog("Handed " + to_string(parked.size()) + " campus connection(s) to the new process", "SUCCESS");
+    return true;
+}
+
+//accept one successor at a time on the handoff socket, exit once it took over
+void handoffListener() {
+    SOCKET listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, handoffPath.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(handoffPath.c_str());
+    if (listenSocket == INVALID_SOCKET || bind(listenSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(listenSocket, 1) == SOCKET_ERROR) {
+        printLog("Failed to listen for a handoff on " + handoffPath, "ERROR");
+        return;
+    }
+    chmod(handoffPath.c_str(), S_IRUSR | S_IWUSR);   //only our own user may take over
+    printLog("Accepting handoffs on " + handoffPath, "SUCCESS");
+    while (true) {
+        SOCKET successor = accept(listenSocket, nullptr, nullptr);
+        if (successor == INVALID_SOCKET) continue;
+        if (handOff(successor)) {
+            //the successor owns the handoff path now, leave it in place
+            cout << flush;
+            _exit(0);
+        }
+        closesocket(successor);
+    }
+}
+
+//start from a running server's sockets and campus table instead of binding our own
+bool takeOver(const string& path) {
+    SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (sock == INVALID_SOCKET || connect(sock, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        printLog("No running server accepts handoffs on " + path, "ERROR");
+        if (sock != INVALID_SOCKET) closesocket(sock);
+        return false;
+    }
+    string record;
+    vector<int> fds;
+    if (!recvHandoffRecord(sock, record, fds) || record.rfind("HANDOFF:", 0) != 0 || fds.size() < 2) {
+        printLog("Malformed handoff from the running server", "ERROR");
+        closesocket(sock);
+        return false;
+    }
+    tcpListenSocket = fds[0];
+    heartbeatSocket = fds[1];
+    if (protocolField(record, "PEER") == "1" && fds.size() > 2) peerListenSocket = fds[2];
+
+    struct Imported {
+        string campusName;
+        SOCKET socket;
+        string pending;
+        shared_ptr<Outbound> outbound;
+    };
+    vector<Imported> imported;
+    while (recvHandoffRecord(sock, record, fds) && record != "END") {
+        if (record.rfind("DEDUP:", 0) == 0) {
+            shared_ptr<DedupWindow> window = dedupWindowOf(protocolField(record, "DEDUP"));
+            string bits = protocolField(record, "BITS");
+            lock_guard<mutex> lock(window->lock);
+            window->started = fromHex(bits.c_str(), bits.length(), reinterpret_cast<unsigned char*>(window->bits),
+                                      sizeof(window->bits));
+            window->highest = strtoull(protocolField(record, "HIGH").c_str(), nullptr, 10);
+            stringstream older(protocolField(record, "OLDER"));
+            string id;
+            while (getline(older, id, ',')) {
+                window->older.insert(strtoull(id.c_str(), nullptr, 10));
+                window->olderOrder.push_back(strtoull(id.c_str(), nullptr, 10));
+            }
+            continue;
+        }
+        size_t headerEnd = record.find('\n');
+        string header = record.substr(0, headerEnd);
+        CampusClient client;
+        client.campusName = protocolField(header, "CLIENT");
+        client.lastHeartbeat = protocolField(header, "HB");
+        client.isActive = protocolField(header, "ACTIVE") == "1" && !fds.empty();
+        client.tcpSocket = client.isActive ? fds[0] : INVALID_SOCKET;
+        string udp = protocolField(header, "UDP");
+        if (!udp.empty()) {
+            memset(&client.udpAddr, 0, sizeof(client.udpAddr));
+            client.udpAddr.sin_family = AF_INET;
+            client.udpAddr.sin_addr.s_addr = inet_addr(udp.substr(0, udp.find('/')).c_str());
+            client.udpAddr.sin_port = htons(atoi(udp.substr(udp.find('/') + 1).c_str()));
+            client.hasUdpAddr = true;
+        }
+        if (client.isActive) {
+            client.outbound = make_shared<Outbound>();
+            client.outbound->framed = protocolField(header, "FRAMED") == "1";
+            client.outbound->worker = static_cast<int>(workerIndexOf(client.campusName));
+            size_t pos = headerEnd + 1;
+            size_t pendingLength = strtoul(protocolField(header, "PENDING").c_str(), nullptr, 10);
+            string pending = record.substr(pos, pendingLength);
+            pos += pendingLength;
+            while (pos < record.length()) {
+                size_t lineEnd = record.find('\n', pos);
+                if (lineEnd == string::npos) break;
+                string item = record.substr(pos, lineEnd - pos);
+                size_t length = strtoul(protocolField(item, "LEN").c_str(), nullptr, 10);
+                int lane = protocolField(item, "ITEM") == "0" ? LANE_URGENT : LANE_BULK;
+                client.outbound->lanes[lane].push_back(OutboundItem{record.substr(lineEnd + 1, length),
+                                                                    chrono::steady_clock::now(), nullptr});
+                pos = lineEnd + 1 + length;
+            }
+            imported.push_back(Imported{client.campusName, client.tcpSocket, move(pending), client.outbound});
+        }
+        lock_guard<mutex> lock(clientMutex);
+        connectedClients[client.campusName] = client;
+    }
+    if (record != "END" || !sendAll(sock, "OK\n")) {
+        printLog("Handoff from the running server was cut short", "ERROR");
+        closesocket(sock);
+        return false;
+    }
+    closesocket(sock);
+    for (auto& connection : imported) {
+        thread writerThread(outboundWriter, connection.socket, connection.outbound);
+        writerThread.detach();
+        thread clientThread(resumeCampusClient, connection.campusName, connection.socket,
+                            move(connection.pending), connection.outbound);
+        clientThread.detach();
+    }
+    printLog("Took over " + to_string(imported.size()) + " campus connection(s) from the previous process", "SUCCESS");
+    return true;
+}
+#endif
+
 //for broadcasting announcements(server to all clients)
-void adminModule(SOCKET udpSocket) {
+void adminModule() {
     string input;
     while (true) {
         clearScreen();
@@ -345,7 +2404,10 @@ void adminModule(SOCKET udpSocket) {
         
         cout << BRIGHT_CYAN << "  [1]" << RESET << " View Connected Campuses" << endl;
         cout << BRIGHT_CYAN << "  [2]" << RESET << " Broadcast Announcement" << endl;
-        cout << BRIGHT_CYAN << "  [3]" << RESET << " Exit Admin" << endl;
+        cout << BRIGHT_CYAN << "  [3]" << RESET << " View Lane Latency" << endl;
+        cout << BRIGHT_CYAN << "  [4]" << RESET << " Reload Credentials" << endl;
+        cout << BRIGHT_CYAN << "  [5]" << RESET << " Export Trace" << endl;
+        cout << BRIGHT_CYAN << "  [6]" << RESET << " Exit Admin" << endl;
         printLine(BRIGHT_YELLOW, '-', 80);
         cout << BRIGHT_WHITE << ">> Choice: " << RESET;
         
@@ -356,12 +2418,17 @@ void adminModule(SOCKET udpSocket) {
             cout << "\n";
             printHeader("CONNECTED CAMPUSES STATUS", BRIGHT_GREEN);
             
-            if (connectedClients.empty()) {
+            map<string, int> remoteCampuses;
+            {
+                lock_guard<mutex> hubLock(hubMutex);
+                remoteCampuses = campusLocations;
+            }
+            if (connectedClients.empty() && remoteCampuses.empty()) {
                 cout << YELLOW << "\n  [!] No campuses connected yet.\n" << RESET << endl;
             } else {
                 cout << "\n";
                 cout << BOLD << "  " << setw(20) << left << "CAMPUS" 
-                          << setw(25) << "LAST HEARTBEAT" 
+                          << setw(25) << "LAST SEEN" 
                           << setw(15) << "STATUS" << RESET << endl;
                 printLine(CYAN, '-', 80);
                 
@@ -374,10 +2441,18 @@ void adminModule(SOCKET udpSocket) {
                     }                     
                     cout << "  "
                         << CYAN  << setw(20) << left << pair.first          << RESET   //campus name
-                        << WHITE << setw(25) << pair.second.lastHeartbeat << RESET   //last heartbeat time
+                        << WHITE << setw(25) << lastSeenOf(pair.second) << RESET   //last heartbeat or TCP message
                         << status                                                  //online/Offline text
                         << endl;
                 }
+                //campuses attached to other hubs of the mesh
+                for (const auto& pair : remoteCampuses) {
+                    cout << "  "
+                        << CYAN  << setw(20) << left << pair.first << RESET
+                        << WHITE << setw(25) << "-" << RESET
+                        << BLUE << "[>] HUB " << pair.second << RESET
+                        << endl;
+                }
             }
             cout << endl;
             printLine(CYAN, '=', 80);   
@@ -394,47 +2469,219 @@ void adminModule(SOCKET udpSocket) {
             string announcement;
             getline(cin, announcement);         
             string broadcastMsg = "BROADCAST:" + announcement;             
-            int sentCount = 0;
-            {//lock the client list so no other thread can modify it
-             //while we’re iterating over it
-             lock_guard<mutex> lock(clientMutex);
-             for (const auto& pair : connectedClients) {
-                 //only send to clients that are currently marked ACTIVE
-                 //and have already sent us a heartbeat (so we know their IP/port)
-                 if (pair.second.isActive && pair.second.hasUdpAddr) {
-                     //send the broadcast message directly to this campus's
-                     //last known UDP address (stored from its heartbeat)
-                     sendto(
-                         udpSocket,
-                         broadcastMsg.c_str(),
-                         static_cast<int>(broadcastMsg.length()),
-                         0,
-                         (sockaddr*)&pair.second.udpAddr,
-                         sizeof(pair.second.udpAddr)
-                     );
-                     //track how many clients actually received the broadcast
-                     sentCount++;
-                 }
-              }
-             }
+            int sentCount = deliverBroadcast(broadcastMsg);
+            //hand it to every linked hub once; they deliver locally and never pass it on
+            int hubCount = 0;
+            {
+                lock_guard<mutex> lock(hubMutex);
+                unsigned long long seq = nextBroadcastSeq++;
+                for (auto& link : peerLinks) {
+                    string frame = "BCAST:" + to_string(hubId) + "|SEQ:" + to_string(seq) +
+                                   "|LEN:" + to_string(announcement.length()) + "\n" + announcement;
+                    if (queueFrame(link.second, LANE_URGENT, move(frame), nullptr, PEER_LANE_LIMIT)) hubCount++;
+                }
+            }
 
             cout << "\n";
-            printLog("Broadcast sent to " + to_string(sentCount) + " campus(es): \"" + 
-                     announcement + "\"", "BROADCAST");             
+            printLog("Broadcast sent to " + to_string(sentCount) + " campus(es) and " + to_string(hubCount) +
+                     " hub(s): \"" + announcement + "\"", "BROADCAST");             
             waitForKey();             
         } else if (input == "3") {
+            clearScreen();
+            cout << "\n";
+            printHeader("OUTBOUND LANE LATENCY (queue -> socket)", BRIGHT_GREEN);
+            cout << "\n";
+            cout << BOLD << "  " << setw(12) << left << "LANE"
+                      << setw(14) << "MESSAGES"
+                      << setw(14) << "P50 (ms)"
+                      << setw(14) << "P99 (ms)"
+                      << setw(14) << "MAX (ms)" << RESET << endl;
+            printLine(CYAN, '-', 80);
+            for (int lane = 0; lane < LANE_COUNT; lane++) {
+                LatencyHistogram hist{};
+                for (const auto& worker : routeWorkers) {
+                    hist.merge(worker->laneLatency[lane]);
+                }
+                cout << "  " << CYAN << setw(12) << left << laneNames[lane] << RESET << WHITE
+                     << setw(14) << hist.total.load() << fixed << setprecision(3)
+                     << setw(14) << hist.percentile(0.50) / 1000.0
+                     << setw(14) << hist.percentile(0.99) / 1000.0
+                     << setw(14) << hist.maxMicros.load() / 1000.0 << RESET << endl;
+            }
+            cout << endl << DIM << "  Scheduling: " << (strictLanes ? "strict" : "weighted " + to_string(urgentWeight) + ":1")
+                 << RESET << endl;
+            string pinning;
+            for (const auto& worker : routeWorkers) {
+                if (worker->cpu >= 0) pinning += (pinning.empty() ? " on CPUs " : ",") + to_string(worker->cpu);
+            }
+            cout << DIM << "  Route workers: " << routeWorkers.size() << pinning << RESET << endl;
+            printLine(CYAN, '=', 80);
+            waitForKey();
+        } else if (input == "4") {
+            clearScreen();
+            reloadCredentials();
+            waitForKey();
+        } else if (input == "5") {
+            clearScreen();
+            long long written = traceBuffer.writeChromeTrace(traceFile, "server", traceProcessId());
+            if (written < 0) {
+                printLog("Failed to write " + traceFile, "ERROR");
+            } else {
+                printLog("Wrote " + to_string(written) + " trace span(s) to " + traceFile, "SUCCESS");
+            }
+            waitForKey();
+        } else if (input == "6") {
             clearScreen();
             printLog("Exiting admin console...", "INFO");
             break;
         } else {
             clearScreen();
-            printLog("Invalid choice! Please select 1, 2, or 3.", "WARNING");
+            printLog("Invalid choice! Please select 1, 2, 3, 4, 5, or 6.", "WARNING");
             this_thread::sleep_for(chrono::seconds(2));
         }
     }
 }
 
-int main() {
+//the header parse routing used before parseRouteHeader, kept as the benchmark baseline
+bool parseWithFindChain(const string& message, string& targetCampus, string& messageId, int& lane) {
+    size_t targetPos = message.find("TARGET:");
+    size_t deptPos = message.find("|DEPT:");
+    size_t fromPos = message.find("|FROM:");
+    size_t msgPos = message.find("|MSG:");
+    if (targetPos == string::npos || deptPos == string::npos ||
+        fromPos == string::npos || msgPos == string::npos) return false;
+    string header = message.substr(targetPos, msgPos - targetPos);
+    targetCampus = protocolField(header, "TARGET");
+    string targetDept = protocolField(header, "DEPT");
+    string sourceCampus = protocolField(header, "FROM");
+    messageId = protocolField(header, "ID");
+    lane = protocolField(header, "PRI") == "URGENT" ? LANE_URGENT : LANE_BULK;
+    return !targetDept.empty() && !sourceCampus.empty();
+}
+
+//server --bench-parser [iterations]: ns per message for the find chain and each delimiter scanner
+void benchParser(long long iterations) {
+    vector<string> messages = {
+        "TARGET:Karachi|DEPT:IT|FROM:Lahore|MSG:Lab schedule for next week",
+        "TARGET:Islamabad|DEPT:Admissions|FROM:Peshawar|PRI:URGENT|ID:1760870400000123|TRACE:0123456789abcdef|MSG:ok",
+        "TARGET:Multan|DEPT:Academics|FROM:CFD|ID:1760870400000124|MSG:note |FROM:nobody ACK:not a reply",
+        "TARGET:Karachi|DEPT:Sports|FROM:Lahore|ID:1760870400000125|MSG:" + string(4000, 'x'),
+    };
+    size_t checksum = 0;
+    auto report = [&](const string& name, const function<void(const string&)>& parse) {
+        auto start = chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; i++) {
+            for (const auto& message : messages) parse(message);
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() /
+                    (static_cast<double>(iterations) * messages.size());
+        cout << "  " << setw(12) << left << name << fixed << setprecision(1) << ns << " ns/message" << endl;
+    };
+    cout << "Routing header parse, " << iterations << " x " << messages.size() << " messages" << endl;
+    report("find chain", [&](const string& message) {
+        string targetCampus, messageId;
+        int lane;
+        if (parseWithFindChain(message, targetCampus, messageId, lane)) checksum += targetCampus.length() + lane;
+    });
+    DelimiterScanner scanners[3];
+    int count = availableDelimiterScanners(scanners);
+    for (int i = 0; i < count; i++) {
+        DelimiterScan scan = scanners[i].scan;
+        report(scanners[i].name, [&](const string& message) {
+            RouteHeader header;
+            if (parseRouteHeader(message, header, scan)) checksum += header.target.length() + header.msg.length();
+        });
+    }
+    cout << "  (checksum " << checksum << ", routing uses " << scanners[0].name << ")" << endl;
+}
+
+//command line: --source-rate R --source-burst B --target-rate R --target-burst B --drr-quantum N
+//              --lane-mode strict|weighted --urgent-weight N --credentials FILE
+//              --port N --udp-port N --hub-id N --peer-port N --peers id@host:port,...
+//              --handoff-socket PATH --takeover PATH --trace-rate R --trace-file FILE
+//              --workers N --worker-cpus CPU,CPU,...
+bool parseServerArgs(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << RED << "[X] Missing value for " << arg << RESET << endl;
+            return false;
+        }
+        string value = argv[++i];
+        //a rate of 0 would answer RETRY_MS:0 forever and a burst below 1 never admits anything
+        auto positive = [&value](double number, double minimum) {
+            if (!(number > 0 && number >= minimum)) throw invalid_argument(value);
+            return number;
+        };
+        try {
+            if (arg == "--source-rate") sourceRate = positive(stod(value), 0);
+            else if (arg == "--source-burst") sourceBurst = positive(stod(value), 1);
+            else if (arg == "--target-rate") targetRate = positive(stod(value), 0);
+            else if (arg == "--target-burst") targetBurst = positive(stod(value), 1);
+            else if (arg == "--drr-quantum") drrQuantum = static_cast<size_t>(positive(stoul(value), 1));   //0 never routes
+            else if (arg == "--credentials") credentialPath = value;
+            else if (arg == "--urgent-weight") urgentWeight = static_cast<unsigned>(max(1UL, stoul(value)));
+            else if (arg == "--port") tcpPort = stoi(value);
+            else if (arg == "--udp-port") udpPort = stoi(value);
+            else if (arg == "--hub-id") hubId = stoi(value);
+            else if (arg == "--peer-port") peerPort = stoi(value);
+            else if (arg == "--handoff-socket") handoffPath = value;
+            else if (arg == "--takeover") takeoverPath = value;
+            else if (arg == "--trace-rate") traceRate = stod(value);
+            else if (arg == "--trace-file") traceFile = value;
+            else if (arg == "--workers") workerCount = static_cast<size_t>(max(1UL, stoul(value)));
+            else if (arg == "--worker-cpus") {
+                stringstream list(value);
+                string cpu;
+                while (getline(list, cpu, ',')) {
+                    workerCpus.push_back(stoi(cpu));
+                    if (workerCpus.back() < 0) throw invalid_argument(cpu);
+                }
+            }
+            else if (arg == "--peers") {
+                stringstream list(value);
+                string entry;
+                while (getline(list, entry, ',')) {
+                    size_t at = entry.find('@');
+                    size_t colon = entry.rfind(':');
+                    if (at == string::npos || colon == string::npos || colon < at) throw invalid_argument(entry);
+                    hubPeers.push_back(HubPeer{stoi(entry.substr(0, at)), entry.substr(at + 1, colon - at - 1),
+                                               stoi(entry.substr(colon + 1))});
+                }
+            }
+            else if (arg == "--lane-mode") {
+                if (value != "strict" && value != "weighted") throw invalid_argument(value);
+                strictLanes = value == "strict";
+            }
+            else {
+                cerr << RED << "[X] Unknown option " << arg << RESET << endl;
+                return false;
+            }
+        } catch (const exception&) {
+            cerr << RED << "[X] Invalid value for " << arg << ": " << value << RESET << endl;
+            return false;
+        }
+    }
+    if (workerCount == 0) {
+        workerCount = workerCpus.empty() ? ROUTE_WORKERS : workerCpus.size();
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    //print a credential file line: server --hash-password <campus> <password>
+    if (argc == 4 && string(argv[1]) == "--hash-password") {
+        cout << makeCredentialLine(argv[2], argv[3]) << endl;
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-parser") {
+        benchParser(argc >= 3 ? atoll(argv[2]) : 1000000);
+        return 0;
+    }
+    if (!parseServerArgs(argc, argv)) {
+        return 1;
+    }
+    createRouteWorkers();
     #ifdef _WIN32
     WSADATA wsaData;
     if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
@@ -459,40 +2706,122 @@ int main() {
     cout << "\n";
     
     printLog("Initializing server components...", "INFO");
+
+    //campus credentials, reloadable with SIGHUP or from the admin console
+    if (!reloadCredentials()) {
+        printLog("No campus can log in until " + credentialPath + " is loaded", "WARNING");
+    }
+    #ifndef _WIN32
+    signal(SIGHUP, onReloadSignal);
+    //a campus or hub that went away is a failed send for its writer, not the end of the server
+    signal(SIGPIPE, SIG_IGN);
+    #endif
+    thread reloadThread(credentialReloadWatcher);
+    reloadThread.detach();
     
-    //create TCP socket
-    SOCKET tcpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (tcpSocket == INVALID_SOCKET) {
-        printLog("Failed to create TCP socket", "ERROR");
+    //zero-downtime upgrade: adopt the running server's sockets and campuses
+    #ifdef _WIN32
+    if (!handoffPath.empty() || !takeoverPath.empty()) {
+        printLog("Handoff needs Unix domain sockets and is not supported on Windows", "ERROR");
         return 1;
     }
+    #else
+    if (!takeoverPath.empty()) {
+        if (!takeOver(takeoverPath)) {
+            return 1;
+        }
+        if (handoffPath.empty()) handoffPath = takeoverPath;
+    }
+    #endif
+    SOCKET tcpSocket = tcpListenSocket;
+    int reuse = 1;
     
     //create UDP socket for broadcasting
-    SOCKET udpBroadcastSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    broadcastSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     
-    //bind TCP socket
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(TCP_PORT);
+    if (tcpSocket == INVALID_SOCKET) {
+        //create TCP socket
+        tcpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (tcpSocket == INVALID_SOCKET) {
+            printLog("Failed to create TCP socket", "ERROR");
+            return 1;
+        }
+        //allow an immediate restart while old connections sit in TIME_WAIT,
+        //so reconnecting campuses find the server again right away
+        setsockopt(tcpSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
     
-    if (bind(tcpSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        printLog("Failed to bind TCP socket on port " + to_string(TCP_PORT), "ERROR");
-        closesocket(tcpSocket);
-        return 1;
-    }
+        //bind TCP socket
+        sockaddr_in serverAddr;
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_addr.s_addr = INADDR_ANY;
+        serverAddr.sin_port = htons(tcpPort);
     
-    if (listen(tcpSocket, 10) == SOCKET_ERROR) {
-        printLog("Failed to listen on TCP socket", "ERROR");
-        closesocket(tcpSocket);
-        return 1;
+        if (bind(tcpSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+            printLog("Failed to bind TCP socket on port " + to_string(tcpPort), "ERROR");
+            closesocket(tcpSocket);
+            return 1;
+        }
+    
+        if (listen(tcpSocket, 10) == SOCKET_ERROR) {
+            printLog("Failed to listen on TCP socket", "ERROR");
+            closesocket(tcpSocket);
+            return 1;
+        }
+        tcpListenSocket = tcpSocket;
     }
     
-    printLog("TCP Server listening on port " + to_string(TCP_PORT), "SUCCESS");
+    printLog("TCP Server listening on port " + to_string(tcpPort), "SUCCESS");
     
     //start UDP heartbeat listener thread
     thread udpThread(handleUDPHeartbeat);
     udpThread.detach();
+
+    //start the route workers
+    for (const auto& worker : routeWorkers) {
+        thread workerThread(runRouteWorker, worker.get());
+        workerThread.detach();
+    }
+    printLog("Routing on " + to_string(routeWorkers.size()) + " worker(s)" +
+             (workerCpus.empty() ? string() : ", pinned to CPUs"), "INFO");
+    printLog("Rate limits: source " + to_string(sourceRate) + "/s (burst " + to_string(sourceBurst) +
+             "), target " + to_string(targetRate) + "/s (burst " + to_string(targetBurst) + ")", "INFO");
+    
+    //mesh with the other hubs: listen for higher ids, dial lower ones
+    if (!hubPeers.empty()) {
+        SOCKET peerSocket = peerListenSocket;
+        if (peerSocket == INVALID_SOCKET) {
+            peerSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            setsockopt(peerSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+            sockaddr_in peerAddr;
+            peerAddr.sin_family = AF_INET;
+            peerAddr.sin_addr.s_addr = INADDR_ANY;
+            peerAddr.sin_port = htons(peerPort);
+            if (bind(peerSocket, (sockaddr*)&peerAddr, sizeof(peerAddr)) == SOCKET_ERROR ||
+                listen(peerSocket, 10) == SOCKET_ERROR) {
+                printLog("Failed to listen for hub links on port " + to_string(peerPort), "ERROR");
+                closesocket(peerSocket);
+                return 1;
+            }
+            peerListenSocket = peerSocket;
+        }
+        thread acceptorThread(peerAcceptor, peerSocket);
+        acceptorThread.detach();
+        for (const auto& peer : hubPeers) {
+            if (peer.id < hubId) {
+                thread dialerThread(peerDialer, peer);
+                dialerThread.detach();
+            }
+        }
+        printLog("Hub " + to_string(hubId) + " meshing with " + to_string(hubPeers.size()) +
+                 " peer(s), links on port " + to_string(peerPort), "SUCCESS");
+    }
+    
+    #ifndef _WIN32
+    if (!handoffPath.empty()) {
+        thread handoffThread(handoffListener);
+        handoffThread.detach();
+    }
+    #endif
     
     //small delay for UDP thread to start
     this_thread::sleep_for(chrono::milliseconds(500));
@@ -502,17 +2831,21 @@ int main() {
     printLine(GREEN, '=', 80);
     cout << "\n";
     
-    //wait for user before starting admin console
-    cout << BRIGHT_YELLOW << "  Press Enter to start admin console..." << RESET << flush;
-    string dummy;
-    getline(cin, dummy);
+    //wait for user before starting admin console (a taken over server keeps
+    //accepting right away, campuses must not notice the upgrade)
+    if (takeoverPath.empty()) {
+        cout << BRIGHT_YELLOW << "  Press Enter to start admin console..." << RESET << flush;
+        string dummy;
+        getline(cin, dummy);
+    }
     
     //start admin module in separate thread
-    thread adminThread(adminModule, udpBroadcastSocket);
+    thread adminThread(adminModule);
     adminThread.detach();
     
     //accept client connections
     while (true) {
+        if (!socketReady(tcpSocket)) continue;
         sockaddr_in clientAddr;
         socklen_t clientAddrLen = sizeof(clientAddr);         
         SOCKET clientSocket = accept(tcpSocket, (sockaddr*)&clientAddr, &clientAddrLen);         
@@ -524,7 +2857,7 @@ int main() {
         }
     }   
     closesocket(tcpSocket);
-    closesocket(udpBroadcastSocket);     
+    closesocket(broadcastSocket);     
     #ifdef _WIN32
     WSACleanup();
     #endif     
@@ -0,0 +1,130 @@
+//sampled message tracing shared by server.cpp and client.cpp
+//include after the platform socket headers, like protocol.h
+//a sampled message carries |TRACE:<hex id> in its header; every process records
+//the stages it saw as spans and can export them as Chrome trace-event JSON
+//(chrome://tracing or ui.perfetto.dev). Timestamps come from the monotonic clock,
+//so traces of processes on one machine line up when loaded together
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#define TRACE_BUFFER_SPANS 65536   //ring size, the oldest spans are overwritten
+
+inline long long traceNowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//true for roughly rate of all calls (0 disables sampling without drawing a number)
+inline bool traceSample(double rate) {
+    if (rate <= 0.0) return false;
+    thread_local std::mt19937_64 random(std::random_device{}());
+    return std::uniform_real_distribution<double>(0.0, 1.0)(random) < rate;
+}
+
+inline unsigned long long newTraceId() {
+    thread_local std::mt19937_64 random(std::random_device{}());
+    unsigned long long id;
+    do {
+        id = random();
+    } while (id == 0);
+    return id;
+}
+
+inline std::string traceIdString(unsigned long long id) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", id);
+    return text;
+}
+
+//0 when the field is absent or malformed
+inline unsigned long long parseTraceId(const std::string& text) {
+    if (text.empty() || text.length() > 16) return 0;
+    return strtoull(text.c_str(), nullptr, 16);
+}
+
+//pid of the exported events (platform headers are included before this file)
+inline long long traceProcessId() {
+#ifdef _WIN32
+    return static_cast<long long>(GetCurrentProcessId());
+#else
+    return static_cast<long long>(getpid());
+#endif
+}
+
+//small id per recording thread, the "tid" of the exported events
+inline unsigned traceThreadId() {
+    static std::atomic<unsigned> nextId(1);
+    thread_local unsigned id = nextId++;
+    return id;
+}
+
+//lock-free span ring: writers claim a slot with one fetch_add and publish it
+//with a sequence number, the exporter skips slots that are being rewritten
+class TraceBuffer {
+public:
+    void record(unsigned long long traceId, const char* name, const char* category,
+                long long startMicros, long long endMicros) {
+        unsigned long long ticket = head.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = slots[ticket % TRACE_BUFFER_SPANS];
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.traceId.store(traceId, std::memory_order_relaxed);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.category.store(category, std::memory_order_relaxed);
+        slot.start.store(startMicros, std::memory_order_relaxed);
+        slot.duration.store(endMicros - startMicros, std::memory_order_relaxed);
+        slot.thread.store(traceThreadId(), std::memory_order_relaxed);
+        slot.sequence.store(ticket + 1, std::memory_order_release);
+    }
+
+    //write every complete span as an "X" event; returns the number written or -1
+    long long writeChromeTrace(const std::string& path, const std::string& processName, long long pid) const {
+        std::ofstream out(path);
+        if (!out) return -1;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"args\":{\"name\":\"" << processName << "\"}}";
+        long long written = 0;
+        for (const Slot& slot : slots) {
+            unsigned long long sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == 0) continue;
+            unsigned long long traceId = slot.traceId.load(std::memory_order_relaxed);
+            const char* name = slot.name.load(std::memory_order_relaxed);
+            const char* category = slot.category.load(std::memory_order_relaxed);
+            long long start = slot.start.load(std::memory_order_relaxed);
+            long long duration = slot.duration.load(std::memory_order_relaxed);
+            unsigned thread = slot.thread.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+            out << ",\n{\"name\":\"" << name << "\",\"cat\":\"" << category << "\",\"ph\":\"X\",\"ts\":" << start
+                << ",\"dur\":" << duration << ",\"pid\":" << pid << ",\"tid\":" << thread
+                << ",\"args\":{\"trace\":\"" << traceIdString(traceId) << "\"}}";
+            written++;
+        }
+        out << "\n]}\n";
+        return out ? written : -1;
+    }
+
+private:
+    struct Slot {
+        std::atomic<unsigned long long> sequence{0};   //ticket + 1 once complete, 0 while written
+        std::atomic<unsigned long long> traceId{0};
+        std::atomic<const char*> name{nullptr};        //string literals only
+        std::atomic<const char*> category{nullptr};
+        std::atomic<long long> start{0};
+        std::atomic<long long> duration{0};
+        std::atomic<unsigned> thread{0};
+    };
+    Slot slots[TRACE_BUFFER_SPANS];
+    std::atomic<unsigned long long> head{0};
+};
+
+#endif